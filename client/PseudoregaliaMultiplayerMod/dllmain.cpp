@@ -15,6 +15,14 @@ class PseudoregaliaMultiplayerMod : public RC::CppUserModBase
 public:
     bool sync_items_hooked = false;
 
+    struct UpdateGhostsParams
+    {
+        RC::Unreal::FScriptArray ghost_info_raw;
+        RC::Unreal::TArray<uint8_t> to_remove;
+    };
+    // reused for every call to UpdateGhosts so the arrays keep their allocations
+    static inline UpdateGhostsParams update_ghosts_params{};
+
     PseudoregaliaMultiplayerMod() : CppUserModBase()
     {
         ModName = STR("PseudoregaliaMultiplayerMod");
@@ -70,16 +78,11 @@ public:
     static void sync_info(RC::Unreal::UnrealScriptFunctionCallableContext& context, void* customdata)
     {
         const auto& player_info = context.GetParams<FST_PlayerInfo>();
-        auto millis = Client::SetPlayerInfo(player_info);
+        Client::SetPlayerInfo(player_info);
 
-        struct UpdateGhostsParams
-        {
-            RC::Unreal::FScriptArray ghost_info_raw;
-            RC::Unreal::TArray<uint8_t> to_remove;
-        };
-        auto params = std::make_unique<UpdateGhostsParams>();
-        Client::GetGhostInfo(millis, params->ghost_info_raw, params->to_remove);
-        if (params->ghost_info_raw.Num() == 0 && params->to_remove.Num() == 0)
+        auto& params = update_ghosts_params;
+        Client::GetGhostInfo(params.ghost_info_raw, params.to_remove);
+        if (params.ghost_info_raw.Num() == 0 && params.to_remove.Num() == 0)
         {
             return;
         }
@@ -90,7 +93,7 @@ public:
             Log(L"Could not find function \"UpdateGhosts\" in \"BP_PM_Manager_C\"", LogType::Error);
             return;
         }
-        context.Context->ProcessEvent(update_ghosts, params.get());
+        context.Context->ProcessEvent(update_ghosts, &params);
     }
 
     static void nop(RC::Unreal::UnrealScriptFunctionCallableContext& context, void* customdata)
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <type_traits>
+
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#endif
+
+// Packs fields of any width from 1 to 32 bits into byte buffers and back, most significant bit first, so fields that
+// happen to be whole bytes on byte boundaries come out big endian. Neither side checks bounds on every field; callers
+// check that a whole run of fields fits with Fits or CanRead first, so the per-field paths stay branch-light. Both
+// sides work in constant expressions too, so layouts built on them can be checked at compile time.
+namespace BitStream
+{
+    // Loads 8 bytes from src as a big endian integer.
+    inline uint64_t LoadBigEndian64(const uint8_t* src)
+    {
+        uint64_t word;
+        std::memcpy(&word, src, sizeof(word));
+        if constexpr (std::endian::native == std::endian::little)
+        {
+#if defined(_MSC_VER)
+            word = _byteswap_uint64(word);
+#else
+            word = __builtin_bswap64(word);
+#endif
+        }
+        return word;
+    }
+
+    class Writer
+    {
+    public:
+        constexpr explicit Writer(std::span<uint8_t> buf) : _buf(buf) {}
+
+        // Whether bits more bits fit in the buffer.
+        constexpr bool Fits(size_t bits) const
+        {
+            return BitsWritten() + bits <= _buf.size() * 8;
+        }
+
+        // Writes the low BITS bits of value.
+        template<size_t BITS>
+        constexpr void Write(uint32_t value)
+        {
+            static_assert(BITS >= 1 && BITS <= 32, "fields are 1 to 32 bits wide");
+            Write(value, BITS);
+        }
+
+        // Writes the low bits bits of value; bits is from 0 to 32.
+        constexpr void Write(uint32_t value, size_t bits)
+        {
+            uint64_t masked = value & ((uint64_t(1) << bits) - 1);
+            _window = (_window << bits) | masked;
+            _window_bits += bits;
+            // whole bytes go out as soon as they're complete, so the window never holds more than 39 bits
+            while (_window_bits >= 8)
+            {
+                _window_bits -= 8;
+                _buf[_pos] = uint8_t(_window >> _window_bits);
+                _pos++;
+            }
+        }
+
+        constexpr void WriteBool(bool value)
+        {
+            Write<1>(value ? 1 : 0);
+        }
+
+        constexpr void WriteF32(float value)
+        {
+            Write<32>(std::bit_cast<uint32_t>(value));
+        }
+
+        // Pads with zeros up to the next byte boundary.
+        constexpr void Align()
+        {
+            if (_window_bits != 0)
+            {
+                Write(0, 8 - _window_bits);
+            }
+        }
+
+        constexpr size_t BitsWritten() const
+        {
+            return _pos * 8 + _window_bits;
+        }
+
+        // The number of bytes touched so far, counting a partly written last byte once it's aligned.
+        constexpr size_t BytesWritten() const
+        {
+            return (BitsWritten() + 7) / 8;
+        }
+
+    private:
+        std::span<uint8_t> _buf;
+        size_t _pos = 0;
+        uint64_t _window = 0;
+        size_t _window_bits = 0;
+    };
+
+    class Reader
+    {
+    public:
+        constexpr explicit Reader(std::span<const uint8_t> buf) : _buf(buf) {}
+
+        // Whether bits more bits are left in the buffer.
+        constexpr bool CanRead(size_t bits) const
+        {
+            return BitsRead() + bits <= _buf.size() * 8;
+        }
+
+        // Reads a BITS bit field.
+        template<size_t BITS>
+        constexpr uint32_t Read()
+        {
+            static_assert(BITS >= 1 && BITS <= 32, "fields are 1 to 32 bits wide");
+            return Read(BITS);
+        }
+
+        // Reads a bits bit field; bits is from 0 to 32. Reading past the end gives zeros rather than touching memory
+        // outside the buffer.
+        constexpr uint32_t Read(size_t bits)
+        {
+            if (_window_bits < bits)
+            {
+                Refill(bits);
+            }
+            _window_bits -= bits;
+            return uint32_t((_window >> _window_bits) & ((uint64_t(1) << bits) - 1));
+        }
+
+        // Reads a bits bit field and sign extends it; bits is from 1 to 32.
+        constexpr int32_t ReadSigned(size_t bits)
+        {
+            uint32_t shift = uint32_t(32 - bits);
+            return int32_t(Read(bits) << shift) >> shift;
+        }
+
+        constexpr bool ReadBool()
+        {
+            return Read<1>() != 0;
+        }
+
+        constexpr float ReadF32()
+        {
+            return std::bit_cast<float>(Read<32>());
+        }
+
+        // Skips ahead to the next byte boundary.
+        constexpr void Align()
+        {
+            _window_bits -= _window_bits % 8;
+        }
+
+        // Skips bits bits without reading them.
+        constexpr void Skip(size_t bits)
+        {
+            for (; bits > 32; bits -= 32)
+            {
+                Read(32);
+            }
+            Read(bits);
+        }
+
+        constexpr size_t BitsRead() const
+        {
+            return _pos * 8 - _window_bits;
+        }
+
+    private:
+        std::span<const uint8_t> _buf;
+        // bytes before _pos have been moved into the window; the unread bits are the low _window_bits of it
+        size_t _pos = 0;
+        uint64_t _window = 0;
+        size_t _window_bits = 0;
+
+        // Tops up the window so it holds at least bits unread bits.
+        constexpr void Refill(size_t bits)
+        {
+            // the bulk load goes through memcpy, so it's skipped when reading at compile time
+            if (!std::is_constant_evaluated() && _pos + 8 <= _buf.size())
+            {
+                // load as many whole bytes as fit on top of the unread bits in one go
+                size_t bytes = (64 - _window_bits) / 8;
+                uint64_t word = LoadBigEndian64(&_buf[_pos]);
+                _window = bytes == 8 ? word : (_window << (bytes * 8)) | (word >> (64 - bytes * 8));
+                _window_bits += bytes * 8;
+                _pos += bytes;
+                return;
+            }
+            while (_window_bits < bits)
+            {
+                uint8_t byte = _pos < _buf.size() ? _buf[_pos] : 0;
+                _window = (_window << 8) | byte;
+                _window_bits += 8;
+                _pos++;
+            }
+        }
+    };
+} // namespace BitStream
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <string>
 
 #include "Unreal/Core/Containers/Array.hpp"
@@ -9,8 +11,16 @@
 
 namespace Client
 {
+    // returns the current time; only differences between results matter, so any steady clock works
+    typedef std::function<std::chrono::steady_clock::time_point()> TimeSource;
+
+    // Replaces where the time comes from. The network thread keeps the source it was started with, so this is ignored
+    // while connected; it only takes effect from the next connection on.
+    void SetTimeSource(TimeSource);
     void OnSceneLoad(std::wstring);
     void Tick();
-    uint32_t SetPlayerInfo(const FST_PlayerInfo&);
-    void GetGhostInfo(const uint32_t&, RC::Unreal::FScriptArray&, RC::Unreal::TArray<uint8_t>&);
+    void SetPlayerInfo(const FST_PlayerInfo&);
+    // Fills the arrays with the ghosts that spawned or changed since the last call, and the ids of ghosts that should
+    // be removed. The arrays can be reused between calls; they're emptied first.
+    void GetGhostInfo(RC::Unreal::FScriptArray&, RC::Unreal::TArray<uint8_t>&);
 }
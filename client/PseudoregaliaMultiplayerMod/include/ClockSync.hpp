@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace ClockSync
+{
+    // number of recent exchanges the outlier filter compares each new one against
+    constexpr size_t MAX_SAMPLES = 8;
+    // number of accepted exchanges the offset and drift are fitted over
+    constexpr size_t MAX_ESTIMATES = 64;
+
+    // Estimates the server's millisecond counter from ping/pong exchanges with it, in the style of NTP. Each exchange
+    // gives a round trip time and an offset between the clocks. Exchanges that took much longer than the fastest
+    // recent one spent time queued somewhere, which skews their offsets, so they're thrown out. The rest are fitted
+    // with a line so slow drift between the two clocks is followed between exchanges.
+    class ClockSync
+    {
+    public:
+        void Clear();
+
+        // Records an exchange whose ping left at our own millis sent, was stamped by the server with server_millis,
+        // and whose pong arrived at our own millis received.
+        void OnPong(uint32_t sent, uint32_t server_millis, uint32_t received);
+
+        // Whether an exchange has been accepted, so our own millis can be converted.
+        bool Ready() const;
+        // Converts our own millis, which can be fractional, to the server's timeline. Should only be called if Ready
+        // returns true. The result isn't wrapped; it wraps like the server's millis when converted to an integer. It
+        // never goes backwards between calls; when the estimate moves back, the timeline holds still until it catches
+        // up, so stamps taken from it stay in order.
+        double ServerMillis(double millis);
+
+        // The round trip time of the fastest recent exchange, in milliseconds.
+        uint32_t Rtt() const;
+        // How much faster the server's clock runs than ours, in parts per million.
+        float Drift() const;
+
+    private:
+        struct Sample
+        {
+            uint32_t millis;
+            int64_t offset;
+            uint32_t rtt;
+        };
+
+        // the most recent exchanges, accepted or not; a ring
+        std::array<Sample, MAX_SAMPLES> _samples{};
+        size_t _samples_head = 0;
+        size_t _samples_count = 0;
+
+        // the accepted exchanges; a ring
+        std::array<Sample, MAX_ESTIMATES> _estimates{};
+        size_t _estimates_head = 0;
+        size_t _estimates_count = 0;
+
+        // the fitted line: the offset at _reference_millis, and how much it changes per milli after that
+        uint32_t _reference_millis = 0;
+        double _offset = 0.0;
+        double _drift = 0.0;
+
+        double _last_server_millis = 0.0;
+        bool _has_server_millis = false;
+
+        void Fit();
+    };
+} // namespace ClockSync
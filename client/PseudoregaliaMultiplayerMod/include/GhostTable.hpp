@@ -0,0 +1,164 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+#include "Interpolator.hpp"
+#include "JitterEstimator.hpp"
+
+namespace GhostTable
+{
+    // number of ghost slots; comfortably above the server's player cap so lobbies can grow without changing the layout
+    constexpr size_t MAX_GHOSTS = 32;
+    // number of states kept per ghost; a power of two so ring indices can wrap with a mask
+    constexpr size_t MAX_STATES = 32;
+
+    static_assert(MAX_GHOSTS <= 32, "active slots are tracked in a uint32_t");
+    static_assert((MAX_STATES & (MAX_STATES - 1)) == 0, "MAX_STATES must be a power of two");
+
+    // a compact pose sample; the ghost's identity (name, color, id) is kept by the caller and only attached when
+    // building the info that gets passed to the bp mod
+    struct State
+    {
+        uint32_t millis;
+        uint32_t zone;
+        // bumped by the ghost whenever it teleports, so it's never interpolated across the jump
+        uint8_t epoch;
+        std::array<float, 3> location;
+        std::array<float, 3> rotation;
+    };
+
+    // Holds the states of every ghost in a dense, slot-indexed, struct-of-arrays layout so that all ghosts can be
+    // interpolated for a frame in one vectorized pass. Each slot keeps a fixed-capacity ring of states sorted by
+    // millis, so neither inserting states nor updating ghosts allocates.
+    class GhostTable
+    {
+    public:
+        GhostTable();
+
+        // Sets how poses are reconstructed from buffered states. Defaults to Hermite interpolation.
+        void SetInterpolator(std::unique_ptr<Interpolator::Interpolator>);
+        // Sets how long a ghost keeps moving with dead reckoning after running out of states before it stops.
+        void SetMaxExtrapolation(uint32_t millis);
+
+        // Claims a slot for the ghost with the given id, clearing anything left over from a previous ghost in that
+        // slot. Returns the slot, or nothing if every slot is taken.
+        std::optional<size_t> Add(uint8_t id);
+        void Remove(uint8_t id);
+        void Clear();
+
+        std::optional<size_t> SlotOf(uint8_t id) const;
+        uint8_t IdOf(size_t slot) const;
+        // bit i is set if slot i is in use
+        uint32_t ActiveSlots() const;
+
+        bool CanInsert(size_t slot, uint32_t ghost_millis) const;
+        // Should only be called if CanInsert returns true; otherwise states can include duplicates or this function
+        // can be unnecessarily called with a state that would be dropped anyway. millis is the shared timeline at
+        // the time the state arrived.
+        void Insert(size_t slot, const State& state, uint32_t millis);
+
+        // Interpolates every ghost for the frame at millis on the shared timeline. millis can be fractional so ghosts
+        // move smoothly at high frame rates, and wraps like the millis of states when converted to an integer. Every
+        // ghost is posed at the same instant, behind millis by the playout delay.
+        void Update(double millis);
+        // How far behind millis the last call to Update posed the ghosts.
+        uint32_t GetPlayoutDelay() const;
+        // The playout delay the ghosts should have: the most any ghost's states need to arrive, counting both the time
+        // they take to reach us and their own playout delay. The actual delay follows it by playing ghosts slightly
+        // faster or slower than real time.
+        uint32_t GetTargetPlayoutDelay() const;
+        // How fast ghosts played in the last call to Update compared to real time, for diagnostics.
+        float GetPlayoutRate() const;
+        // How many times the playout delay was too far off its target to catch up on, so it jumped instead.
+        uint32_t GetPlayoutJumps() const;
+        // Whether the slot got a pose from the last call to Update.
+        bool HasPose(size_t slot) const;
+        // The pose calculated for the slot by the last call to Update.
+        State GetPose(size_t slot) const;
+        // The estimator sizing the slot's playout delay, for diagnostics.
+        const JitterEstimator::JitterEstimator& GetJitter(size_t slot) const;
+
+    private:
+        static constexpr size_t NO_SLOT = 0xff;
+
+        // per-state data; the states for slot s live at [s * MAX_STATES, (s + 1) * MAX_STATES). unused entries have
+        // millis set to UINT32_MAX so the bracketing search can scan whole rows without checking counts
+        alignas(32) std::array<uint32_t, MAX_GHOSTS * MAX_STATES> _millis;
+        alignas(32) std::array<uint32_t, MAX_GHOSTS * MAX_STATES> _zone;
+        std::array<uint8_t, MAX_GHOSTS * MAX_STATES> _epoch;
+        alignas(32) std::array<float, MAX_GHOSTS * MAX_STATES> _location_x;
+        alignas(32) std::array<float, MAX_GHOSTS * MAX_STATES> _location_y;
+        alignas(32) std::array<float, MAX_GHOSTS * MAX_STATES> _location_z;
+        alignas(32) std::array<float, MAX_GHOSTS * MAX_STATES> _rotation_x;
+        alignas(32) std::array<float, MAX_GHOSTS * MAX_STATES> _rotation_y;
+        alignas(32) std::array<float, MAX_GHOSTS * MAX_STATES> _rotation_z;
+
+        // per-slot ring bookkeeping; the oldest state of slot s is at index _head[s] of its row
+        std::array<uint8_t, MAX_GHOSTS> _head;
+        std::array<uint8_t, MAX_GHOSTS> _count;
+
+        // tracks how long each slot's states take to arrive and how much headroom they need on top of that
+        std::array<JitterEstimator::JitterEstimator, MAX_GHOSTS> _jitter;
+
+        // the playout delay shared by every ghost, and the rate it's played at to catch up on its target
+        double _playout_delay = 0.0;
+        double _target_playout_delay = 0.0;
+        double _playout_rate = 1.0;
+        uint32_t _playout_jumps = 0;
+        bool _playout_ready = false;
+        bool _catching_up = false;
+
+        // staging for the interpolator, filled by the bracketing pass in Update; see Interpolator::Batch
+        std::unique_ptr<Interpolator::Interpolator> _interpolator;
+        alignas(32) std::array<float, MAX_GHOSTS * Interpolator::COMPONENTS> _before;
+        alignas(32) std::array<float, MAX_GHOSTS * Interpolator::COMPONENTS> _lower;
+        alignas(32) std::array<float, MAX_GHOSTS * Interpolator::COMPONENTS> _upper;
+        alignas(32) std::array<float, MAX_GHOSTS * Interpolator::COMPONENTS> _after;
+        alignas(32) std::array<float, MAX_GHOSTS> _pct;
+        alignas(32) std::array<float, MAX_GHOSTS> _lower_weight;
+        alignas(32) std::array<float, MAX_GHOSTS> _upper_weight;
+
+        // dead reckoning: once a ghost's target time passes its newest state, it keeps moving at the velocity (per
+        // milli) between its two newest states for _extrapolation millis, capped at _max_extrapolation
+        uint32_t _max_extrapolation = 200;
+        alignas(32) std::array<float, MAX_GHOSTS * Interpolator::COMPONENTS> _velocity{};
+        alignas(32) std::array<float, MAX_GHOSTS> _extrapolation{};
+        std::array<uint32_t, MAX_GHOSTS> _extrapolated_from{};
+        uint32_t _extrapolating_slots = 0;
+
+        // offsets added to poses to blend out the difference when real data replaces a guess from dead reckoning;
+        // they decay a little every frame
+        alignas(32) std::array<float, MAX_GHOSTS * Interpolator::COMPONENTS> _correction{};
+        std::optional<double> _last_update_millis;
+
+        // poses from the interpolator, and the final poses from the last call to Update; components are stored as
+        // rows of MAX_GHOSTS in the order location x, y, z, rotation x, y, z
+        alignas(32) std::array<float, MAX_GHOSTS * Interpolator::COMPONENTS> _raw{};
+        alignas(32) std::array<float, MAX_GHOSTS * Interpolator::COMPONENTS> _pose{};
+        std::array<uint32_t, MAX_GHOSTS> _pose_millis;
+        std::array<uint32_t, MAX_GHOSTS> _pose_zone{};
+        std::array<uint8_t, MAX_GHOSTS> _pose_epoch{};
+        uint32_t _posed_slots = 0;
+
+        std::array<uint8_t, 256> _slot_of_id;
+        std::array<uint8_t, MAX_GHOSTS> _id_of_slot;
+        uint32_t _active_slots = 0;
+
+        bool Continuous(size_t a, size_t b) const;
+        size_t Index(size_t slot, size_t i) const;
+        size_t LowerBound(size_t slot, uint32_t ghost_millis) const;
+        void ClearSlot(size_t slot);
+        void Stage(size_t slot, size_t lower, size_t upper);
+        void AdvancePlayout(double target, bool any_ready, double elapsed);
+        void StageExtrapolation(size_t slot, float past_newest);
+        void Correct(
+            size_t slot,
+            const std::array<float, MAX_GHOSTS * Interpolator::COMPONENTS>& previous_velocity,
+            float advance);
+        void ApplyMotion(float decay);
+        void CopyState(size_t from, size_t to);
+    };
+} // namespace GhostTable
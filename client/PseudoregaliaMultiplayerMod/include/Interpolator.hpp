@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+
+namespace Interpolator
+{
+    // number of pose components; location x, y, z come first and rotation x, y, z last
+    constexpr size_t COMPONENTS = 6;
+    constexpr size_t LOCATION_COMPONENTS = 3;
+
+    // The states around the target time of every ghost in a batch. Each state array holds COMPONENTS rows of size
+    // floats, one entry per ghost, and size must be a multiple of 8. Rotations are unwrapped relative to lower, so the
+    // shortest arc between two neighbouring states is always a plain difference.
+    struct Batch
+    {
+        size_t size;
+        // the state before lower, or a stand-in mirrored from upper if there isn't one
+        const float* before;
+        // the states directly before and after the target time
+        const float* lower;
+        const float* upper;
+        // the state after upper, or a stand-in mirrored from lower if there isn't one
+        const float* after;
+        // how far the target time is from lower to upper, between 0 and 1
+        const float* pct;
+        // the span from lower to upper divided by the span from before to upper and from lower to after; these scale
+        // the tangents at lower and upper for states that aren't evenly spaced in time
+        const float* lower_weight;
+        const float* upper_weight;
+    };
+
+    // Reconstructs ghost poses from a batch of buffered states.
+    class Interpolator
+    {
+    public:
+        virtual ~Interpolator() = default;
+
+        // Writes COMPONENTS rows of batch.size floats to pose, with rotations wrapped to [-180.0, 180.0].
+        virtual void Interpolate(const Batch& batch, float* pose) const = 0;
+    };
+
+    enum class Kind
+    {
+        // straight lines between states
+        Linear,
+        // Catmull-Rom style cubic Hermite curves, with tangents taken from the neighbouring states
+        Hermite,
+    };
+
+    std::optional<Kind> ParseKind(const std::string&);
+    std::unique_ptr<Interpolator> Create(Kind);
+} // namespace Interpolator
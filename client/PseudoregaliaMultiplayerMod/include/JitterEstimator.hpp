@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace JitterEstimator
+{
+    constexpr size_t MAX_OFFSETS = 100;
+
+    // Watches when a ghost's states arrive compared to when they were sent and sizes how far behind the ghost should
+    // be played back, so that states have time to arrive without adding more delay than the link needs.
+    class JitterEstimator
+    {
+    public:
+        void Clear();
+
+        // Records a state sent at the ghost's ghost_millis that arrived at our own millis. newest is whether it's
+        // newer than every state received before it.
+        void OnArrival(uint32_t ghost_millis, uint32_t millis, bool newest);
+
+        // Whether enough has arrived to calculate an offset.
+        bool Ready() const;
+        // The average difference between when the ghost's states were sent and when they arrived. Since both are on
+        // the shared timeline, this is minus the average time they take to reach us.
+        int64_t Offset() const;
+        // How far behind the offset the ghost should be played back, in milliseconds.
+        float Delay() const;
+        // Smoothed variation in how long states take to arrive, in milliseconds.
+        float Jitter() const;
+        // Smoothed fraction of states that never arrived.
+        float Loss() const;
+
+    private:
+        // these fields let us easily check the average offset over the last MAX_OFFSETS messages received; the
+        // history is a ring
+        int64_t _total_offset = 0;
+        std::array<int64_t, MAX_OFFSETS> _offsets{};
+        size_t _offsets_head = 0;
+        size_t _offsets_count = 0;
+
+        // interarrival jitter as described in RFC 3550, along with the last transit time it was calculated from
+        float _jitter = 0.0f;
+        int64_t _last_transit = 0;
+        bool _has_transit = false;
+
+        // the usual gap between states, and the fraction of states that go missing
+        float _interval = 0.0f;
+        float _loss = 0.0f;
+        uint32_t _newest_millis = 0;
+
+        float _delay = 0.0f;
+
+        void UpdateLoss(uint32_t ghost_millis);
+        void UpdateDelay();
+    };
+} // namespace JitterEstimator
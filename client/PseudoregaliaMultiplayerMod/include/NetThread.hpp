@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "GhostTable.hpp"
+
+// Runs the connection to the server on a thread of its own: the WebSocket and UDP socket, clock sync pings, acks, and
+// decoding states. The game thread talks to it only through lock-free rings, so nothing network-driven happens inside
+// a frame; it hands over commands, and takes back ghost samples and events.
+namespace NetThread
+{
+    // returns the current time; the same source the game thread uses, so both agree on our own millis
+    typedef std::function<std::chrono::steady_clock::time_point()> TimeSource;
+
+    // Something the game thread asks of the network thread.
+    struct Command
+    {
+        enum class Kind
+        {
+            // we're in the zone called zone_name now
+            SceneLoad,
+            // send our state, stamped with millis on the server's timeline
+            Update,
+        };
+
+        Kind kind = Kind::Update;
+        std::string zone_name;
+        uint32_t millis = 0;
+        uint8_t epoch = 0;
+        std::array<double, 3> location{};
+        std::array<double, 3> rotation{};
+    };
+
+    // Something the network thread tells the game thread. Which of the fields are used depends on kind.
+    struct Event
+    {
+        enum class Kind
+        {
+            // the server gave us id; a PlayerJoined follows for everyone already connected
+            Connected,
+            // player id with name and color joined
+            PlayerJoined,
+            // player id left
+            PlayerLeft,
+            // the server gave the zone called name index zone
+            ZoneIndex,
+            // the server won't give the zone called name an index, for reason
+            ZoneRejected,
+            // a clock sync exchange: the ping left at our own millis sent, was stamped server_millis by the server, and
+            // the pong arrived at our own millis received
+            Pong,
+            // the connection closed or couldn't be opened; the game thread should call Stop
+            Closed,
+        };
+
+        Kind kind = Kind::Closed;
+        uint8_t id = 0;
+        std::string name;
+        std::string reason;
+        std::array<uint8_t, 3> color{};
+        uint8_t zone = 0;
+        uint32_t sent = 0;
+        uint32_t server_millis = 0;
+        uint32_t received = 0;
+    };
+
+    // how many samples the ring between the threads holds; one slot of it always stays empty
+    constexpr size_t SAMPLE_RING = 1024;
+
+    // A state decoded from a server packet, ready to be inserted into the ghost table.
+    struct Sample
+    {
+        uint8_t id;
+        GhostTable::State state;
+        // when it arrived, on the server's timeline
+        uint32_t millis;
+    };
+
+    // Starts the thread and connects to the server in the settings, with our own millis counting from clock_start.
+    // Should only be called if the thread isn't running. Returns false without starting it if the thread of the last
+    // connection hasn't finished yet, in which case it should be tried again later.
+    bool Start(TimeSource, std::chrono::steady_clock::time_point clock_start);
+    // Asks the thread to disconnect and returns without waiting for it; it finishes by itself, and anything still on
+    // the rings is dropped by the next Start.
+    void Stop();
+    bool Running();
+
+    // The game thread's end of the rings. Push wakes the thread so the command is handled right away, and returns false
+    // if it couldn't be queued.
+    bool Push(Command&);
+    bool PopEvent(Event&);
+    bool PopSample(Sample&);
+} // namespace NetThread
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace PacketAcks
+{
+    // how many packets before the latest one the ack bitfield covers; it shares 16 bits with the has_ack flag
+    constexpr size_t ACK_BITS = 15;
+    // number of sent packets remembered while waiting for an ack; a power of two so sequence numbers can wrap with a
+    // mask. anything not acked by the time its entry is reused counts as lost
+    constexpr size_t MAX_SENT = 32;
+
+    static_assert((MAX_SENT & (MAX_SENT - 1)) == 0, "MAX_SENT must be a power of two");
+    static_assert(MAX_SENT > ACK_BITS, "packets must stay remembered for as long as they can still be acked");
+
+    // The header at the start of every state packet, after the kind.
+    struct Header
+    {
+        // the sequence number of this packet
+        uint16_t sequence;
+        // whether anything has been received from the peer yet; if not, ack and ack_bits mean nothing
+        bool has_ack;
+        // the newest sequence number received from the peer
+        uint16_t ack;
+        // bit i is set if sequence number ack - 1 - i was also received
+        uint16_t ack_bits;
+    };
+
+    // Counters for diagnostics; they're never reset while connected.
+    struct Stats
+    {
+        uint32_t sent = 0;
+        uint32_t acked = 0;
+        uint32_t lost = 0;
+        uint32_t received = 0;
+        uint32_t duplicates = 0;
+        // packets that arrived after a newer one
+        uint32_t reordered = 0;
+    };
+
+    // Numbers the packets sent to a peer, tracks which packets have been received from them, and works out from the
+    // acks in their packets which of ours made it, how long that took, and which were lost.
+    class PacketAcks
+    {
+    public:
+        void Clear();
+
+        // Returns the header for the next packet sent at millis, and remembers when it was sent.
+        Header Send(uint32_t millis);
+        // Records a packet received from the peer at millis. Returns false if it's a duplicate or too old to track,
+        // in which case it should be dropped.
+        bool Receive(const Header& header, uint32_t millis);
+
+        // Smoothed round trip time, in milliseconds, or 0 if nothing has been acked yet.
+        float Rtt() const;
+        // Smoothed fraction of our packets that were lost.
+        float Loss() const;
+        // The sequence number of the newest of our packets the peer has acked, if any.
+        std::optional<uint16_t> NewestAcked() const;
+        // Whether the packet we sent with sequence is still waiting for an ack. Packets too old to be remembered
+        // aren't.
+        bool Pending(uint16_t sequence) const;
+        const Stats& GetStats() const;
+
+    private:
+        struct Sent
+        {
+            uint32_t millis;
+            bool pending;
+        };
+
+        uint16_t _next_sequence = 0;
+        std::array<Sent, MAX_SENT> _sent{};
+
+        uint16_t _remote_sequence = 0;
+        uint16_t _remote_bits = 0;
+        bool _has_remote = false;
+
+        std::optional<uint16_t> _newest_acked = {};
+
+        float _rtt = 0.0f;
+        float _loss = 0.0f;
+        Stats _stats;
+
+        void Ack(uint16_t sequence, uint32_t millis);
+    };
+} // namespace PacketAcks
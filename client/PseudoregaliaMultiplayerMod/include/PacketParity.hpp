@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace PacketParity
+{
+    // the most packets one parity packet can cover; a group of 1 makes the parity a copy of every packet
+    constexpr size_t MAX_GROUP = 8;
+    // a parity packet is the kind, then this header: the sequence number of the first packet it covers, how many
+    // packets it covers, and the xor of their lengths after the kind. then comes the xor of their bytes after the
+    // kind, with the shorter ones padded with zeros
+    constexpr size_t HEADER_LEN = 5;
+    // the longest packet that can be remembered or rebuilt, kind included
+    constexpr size_t MAX_PACKET_LEN = 508;
+
+    // Remembers the last few state packets from the server, so that when a parity packet arrives, the one packet of
+    // its group that went missing, if only one did, can be rebuilt without waiting for anything to be resent.
+    class PacketParity
+    {
+    public:
+        void Clear();
+
+        // Remembers the state packet with sequence, starting with its kind.
+        void Received(uint16_t sequence, std::span<const uint8_t> packet);
+        // Rebuilds the missing packet of the group parity covers, where parity is the packet after its kind. Returns
+        // the length of the packet written to out, which leaves the first byte for the caller to fill in with the
+        // kind, or 0 if none of the group is missing, more than one is, or the parity doesn't add up.
+        size_t Recover(std::span<const uint8_t> parity, std::span<uint8_t, MAX_PACKET_LEN> out);
+
+        // How many packets have been rebuilt, for diagnostics.
+        uint32_t Recovered() const;
+
+    private:
+        struct Entry
+        {
+            uint16_t sequence = 0;
+            // 0 if nothing is remembered here
+            size_t len = 0;
+            std::array<uint8_t, MAX_PACKET_LEN> bytes{};
+        };
+
+        std::array<Entry, MAX_GROUP> _entries{};
+        uint32_t _recovered = 0;
+    };
+}
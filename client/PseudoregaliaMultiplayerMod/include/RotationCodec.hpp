@@ -0,0 +1,14 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Rotations go over the wire as fixed point fractions of a turn, offset so -180 degrees is 0. Each axis gets as many
+// bits as the state schema gives it; yaw (z) matters most for how a ghost looks, so it gets the most.
+namespace RotationCodec
+{
+    // Quantizes rotation, in degrees, to the nearest step on each axis.
+    std::array<uint16_t, 3> Quantize(const std::array<double, 3>& rotation);
+    // Maps a quantized rotation back to degrees, from -180 up to but not including 180.
+    std::array<float, 3> Dequantize(const std::array<uint16_t, 3>& quantized);
+} // namespace RotationCodec
@@ -10,4 +10,7 @@ namespace Settings
     const std::string& GetPort();
     const std::array<uint8_t, 3>& GetColor();
     const std::string& GetName();
+    const std::string& GetInterpolation();
+    uint32_t GetMaxExtrapolation();
+    uint32_t GetFecGroup();
 }
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+
+// Picks the instruction set used by the ghost kernels at compile time: AVX2 if the build targets it (see the
+// PSEUDOREGALIA_MULTIPLAYER_AVX2 CMake option), otherwise SSE2, which is always available on x64. Kernels fall back
+// to scalar code if neither is defined.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_SSE2
+#endif
+
+// Thin wrappers over whichever instruction set was picked so kernels only have to be written once. Vec holds WIDTH
+// floats, and pointers passed to Load and Store must be aligned to 32 bytes.
+namespace Simd
+{
+#if defined(SIMD_AVX2)
+    typedef __m256 Vec;
+    constexpr size_t WIDTH = 8;
+    inline Vec Load(const float* src) { return _mm256_load_ps(src); }
+    inline void Store(float* dst, Vec v) { _mm256_store_ps(dst, v); }
+    inline Vec Set(float f) { return _mm256_set1_ps(f); }
+    inline Vec Add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+    inline Vec Sub(Vec a, Vec b) { return _mm256_sub_ps(a, b); }
+    inline Vec Mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+    inline Vec Round(Vec v) { return _mm256_round_ps(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+#elif defined(SIMD_SSE2)
+    typedef __m128 Vec;
+    constexpr size_t WIDTH = 4;
+    inline Vec Load(const float* src) { return _mm_load_ps(src); }
+    inline void Store(float* dst, Vec v) { _mm_store_ps(dst, v); }
+    inline Vec Set(float f) { return _mm_set1_ps(f); }
+    inline Vec Add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+    inline Vec Sub(Vec a, Vec b) { return _mm_sub_ps(a, b); }
+    inline Vec Mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+    // relies on the default rounding mode, which rounds to nearest; fine for the angles this is used on
+    inline Vec Round(Vec v) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(v)); }
+#else
+    typedef float Vec;
+    constexpr size_t WIDTH = 1;
+    inline Vec Load(const float* src) { return *src; }
+    inline void Store(float* dst, Vec v) { *dst = v; }
+    inline Vec Set(float f) { return f; }
+    inline Vec Add(Vec a, Vec b) { return a + b; }
+    inline Vec Sub(Vec a, Vec b) { return a - b; }
+    inline Vec Mul(Vec a, Vec b) { return a * b; }
+    inline Vec Round(Vec v) { return float(int(v + (v < 0.0f ? -0.5f : 0.5f))); }
+#endif
+
+    // Wraps angles in degrees to [-180.0, 180.0].
+    inline Vec WrapAngle(Vec angle)
+    {
+        return Sub(angle, Mul(Set(360.0f), Round(Mul(angle, Set(1.0f / 360.0f)))));
+    }
+} // namespace Simd
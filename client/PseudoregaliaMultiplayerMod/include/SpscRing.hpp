@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace SpscRing
+{
+    // A fixed-capacity queue between exactly one producer thread and one consumer thread, which never locks or
+    // allocates. SIZE must be a power of two so indices can wrap with a mask; it holds up to SIZE - 1 items, since one
+    // slot is kept empty to tell a full ring from an empty one.
+    template<typename T, size_t SIZE>
+    class SpscRing
+    {
+    public:
+        static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two");
+
+        // Moves item onto the ring. Should only be called from the producer thread. Returns false, leaving item as it
+        // was, if the ring is full.
+        bool TryPush(T& item)
+        {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            size_t next = (tail + 1) & (SIZE - 1);
+            if (next == _head.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+            _items[tail] = std::move(item);
+            _tail.store(next, std::memory_order_release);
+            return true;
+        }
+
+        // Moves the oldest item off the ring into item. Should only be called from the consumer thread. Returns false
+        // if the ring is empty.
+        bool TryPop(T& item)
+        {
+            size_t head = _head.load(std::memory_order_relaxed);
+            if (head == _tail.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+            item = std::move(_items[head]);
+            _head.store((head + 1) & (SIZE - 1), std::memory_order_release);
+            return true;
+        }
+
+        // Drops every item. Should only be called while neither thread is using the ring.
+        void Clear()
+        {
+            _head.store(0, std::memory_order_relaxed);
+            _tail.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        std::array<T, SIZE> _items{};
+        // the producer and consumer each write one of these, so they're kept on separate cache lines
+        alignas(64) std::atomic<size_t> _head = 0;
+        alignas(64) std::atomic<size_t> _tail = 0;
+    };
+} // namespace SpscRing
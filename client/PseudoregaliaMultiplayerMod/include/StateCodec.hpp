@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "BitStream.hpp"
+#include "PacketAcks.hpp"
+#include "StateSchema.hpp"
+
+namespace StateCodec
+{
+    using StateSchema::WireState;
+
+    // a full state is the id, a zero baseline age, then the rest of the canonical layout; this is how many bytes it
+    // takes up, rounded up
+    constexpr size_t FULL_LEN = (StateSchema::Layout::BITS + 8 + 7) / 8;
+    // the shortest delta: id, baseline age, field mask, and a one byte millis delta
+    constexpr size_t MIN_LEN = 5;
+    // a frame is a baseline age, millis, and zone
+    constexpr size_t FRAME_BITS = 8 + 32 + 8;
+    // the shortest state in a frame: id, a bit saying it uses the frame's age, field mask, and a one byte millis delta
+    constexpr size_t MIN_FRAMED_BITS = 8 + 1 + 16 + 8;
+    // deltas can only refer back to packets the receiver still remembers
+    constexpr size_t MAX_AGE = PacketAcks::MAX_SENT - 1;
+
+    // What the states of a packet from the server share, written once before them. States in a frame only spend a
+    // bit on their baseline age if it's the frame's, and full ones can give their millis as an offset from the
+    // frame's and leave out their zone if it's the frame's.
+    struct Frame
+    {
+        uint8_t age;
+        uint32_t millis;
+        uint8_t zone;
+    };
+
+    // What ReadPrefix finds at the start of an encoded state.
+    struct Encoded
+    {
+        uint8_t id;
+        // how many packets before the one holding this state its baseline was sent in, or 0 for a full state
+        uint8_t age;
+        // which fields a delta holds, or for a full state in a frame, which fields it takes from the frame
+        uint16_t mask;
+        // how many bits of the state are left after the prefix
+        size_t bits;
+    };
+
+    void WriteFrame(const Frame& frame, BitStream::Writer& writer);
+    // Returns nothing if the reader runs out or the frame is malformed.
+    std::optional<Frame> ReadFrame(BitStream::Reader& reader);
+
+    // Encodes state into writer, which must have room for FULL_LEN bytes. If baseline is given, it's the state sent
+    // age packets before this one that the receiver is known to have, and only what changed from it is written; if
+    // that wouldn't be any shorter, the full state is written instead. If frame is given, the state is written in
+    // it, which can take up to 3 more bits.
+    void Encode(const WireState& state, const WireState* baseline, uint8_t age, const Frame* frame,
+        BitStream::Writer& writer);
+    // Reads the id, baseline age, and field mask at the start of an encoded state, and works out how long the rest of
+    // it is. frame must be the one the state was encoded in, if any. Returns nothing if the reader runs out or the
+    // state is malformed; otherwise the caller still has to check that encoded.bits can be read before decoding.
+    std::optional<Encoded> ReadPrefix(BitStream::Reader& reader, const Frame* frame);
+    // Decodes the rest of the state ReadPrefix returned encoded for. baseline must be the state sent encoded.age
+    // packets earlier, and is ignored for full states.
+    WireState Decode(BitStream::Reader& reader, const Encoded& encoded, const WireState* baseline, const Frame* frame);
+
+    // The states one side sent the other over the last PacketAcks::MAX_SENT packets, by the sequence number of the
+    // packet each went out in, so deltas can be encoded against or decoded from whichever one the receiver has.
+    class History
+    {
+    public:
+        void Clear();
+        void Put(uint16_t sequence, const WireState& state);
+        // Returns the state sent in the packet with sequence, or nullptr if it isn't remembered.
+        const WireState* Get(uint16_t sequence) const;
+
+    private:
+        struct Entry
+        {
+            uint16_t sequence;
+            bool valid;
+            WireState state;
+        };
+
+        std::array<Entry, PacketAcks::MAX_SENT> _entries{};
+    };
+} // namespace StateCodec
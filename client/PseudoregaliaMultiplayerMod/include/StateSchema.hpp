@@ -0,0 +1,282 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "BitStream.hpp"
+
+// The canonical layout of a player state, declared once as a list of fields. The full width encoder and decoder, the
+// offset and width of every field, and STATE_LEN are all generated from it, and it's checked at compile time against
+// the golden fixture in protocol/canonical-state.inc, which the server checks its own layout against too.
+namespace StateSchema
+{
+    // a player state as it goes over the wire. rotation is kept quantized so deltas compare exactly what was sent
+    struct WireState
+    {
+        uint8_t id;
+        uint32_t millis;
+        // the index the server gave the name of the zone the player is in when it was registered
+        uint8_t zone;
+        uint8_t epoch;
+        // fixed point, in steps from the centre of the zone's box; see ZoneBounds
+        std::array<int32_t, 3> location;
+        // fixed point fractions of a turn; see RotationCodec
+        std::array<uint16_t, 3> rotation;
+
+        bool operator==(const WireState&) const = default;
+    };
+
+    // A member of WireState written as BITS bits. Arrays are written an element at a time, either all BITS bits wide
+    // or, if a width is given for each element, each with its own. Signed members are sign extended when read.
+    template<auto MEMBER, size_t... BITS>
+    struct Field
+    {
+        using Type = std::remove_cvref_t<decltype(std::declval<WireState>().*MEMBER)>;
+
+        static constexpr auto POINTER = MEMBER;
+        static constexpr size_t COUNT = []()
+        {
+            if constexpr (std::is_class_v<Type>)
+            {
+                return std::tuple_size_v<Type>;
+            }
+            else
+            {
+                return size_t(1);
+            }
+        }();
+        static_assert(sizeof...(BITS) == 1 || sizeof...(BITS) == COUNT, "give one width, or one for each element");
+        static_assert(((BITS >= 1 && BITS <= 32) && ...), "fields are 1 to 32 bits wide");
+        // the width of each element
+        static constexpr std::array<size_t, COUNT> WIDTHS = []()
+        {
+            std::array<size_t, COUNT> widths{};
+            size_t given[] = { BITS... };
+            for (size_t i = 0; i < COUNT; i++)
+            {
+                widths[i] = given[sizeof...(BITS) == 1 ? 0 : i];
+            }
+            return widths;
+        }();
+        static constexpr size_t TOTAL_BITS = (sizeof...(BITS) == 1 ? COUNT : 1) * (BITS + ...);
+
+        static constexpr void Write(const WireState& state, BitStream::Writer& writer)
+        {
+            if constexpr (std::is_class_v<Type>)
+            {
+                for (size_t i = 0; i < COUNT; i++)
+                {
+                    writer.Write(ToBits((state.*MEMBER)[i]), WIDTHS[i]);
+                }
+            }
+            else
+            {
+                writer.Write(ToBits(state.*MEMBER), WIDTHS[0]);
+            }
+        }
+
+        static constexpr void Read(WireState& state, BitStream::Reader& reader)
+        {
+            if constexpr (std::is_class_v<Type>)
+            {
+                for (size_t i = 0; i < COUNT; i++)
+                {
+                    auto& element = (state.*MEMBER)[i];
+                    element = FromBits<std::remove_cvref_t<decltype(element)>>(reader.Read(WIDTHS[i]), WIDTHS[i]);
+                }
+            }
+            else
+            {
+                state.*MEMBER = FromBits<Type>(reader.Read(WIDTHS[0]), WIDTHS[0]);
+            }
+        }
+
+    private:
+        template<typename T>
+        static constexpr uint32_t ToBits(T value)
+        {
+            if constexpr (std::is_floating_point_v<T>)
+            {
+                return std::bit_cast<uint32_t>(value);
+            }
+            else
+            {
+                return uint32_t(value);
+            }
+        }
+
+        template<typename T>
+        static constexpr T FromBits(uint32_t bits, size_t width)
+        {
+            if constexpr (std::is_floating_point_v<T>)
+            {
+                return std::bit_cast<T>(bits);
+            }
+            else if constexpr (std::is_signed_v<T>)
+            {
+                // sign extend from width bits
+                uint32_t shift = uint32_t(32 - width);
+                return T(int32_t(bits << shift) >> shift);
+            }
+            else
+            {
+                return T(bits);
+            }
+        }
+    };
+
+    // A list of Fields laid out back to back in order.
+    template<typename... FIELDS>
+    struct Fields
+    {
+        static constexpr size_t COUNT = sizeof...(FIELDS);
+        // OFFSETS[i] is how many bits come before field i; the last entry is the length of the whole layout
+        static constexpr std::array<size_t, COUNT + 1> OFFSETS = []()
+        {
+            std::array<size_t, COUNT + 1> offsets{};
+            size_t widths[] = { FIELDS::TOTAL_BITS... };
+            for (size_t i = 0; i < COUNT; i++)
+            {
+                offsets[i + 1] = offsets[i] + widths[i];
+            }
+            return offsets;
+        }();
+        static constexpr size_t BITS = OFFSETS[COUNT];
+
+        // Returns the index of the field for member.
+        template<auto MEMBER>
+        static constexpr size_t IndexOf()
+        {
+            bool matches[] = { Matches<FIELDS, MEMBER>()... };
+            for (size_t i = 0; i < COUNT; i++)
+            {
+                if (matches[i])
+                {
+                    return i;
+                }
+            }
+            return COUNT;
+        }
+
+        // How many bits element i of the field for member takes up.
+        template<auto MEMBER>
+        static constexpr size_t WidthOf(size_t i = 0)
+        {
+            constexpr size_t index = IndexOf<MEMBER>();
+            static_assert(index < COUNT, "member isn't in the layout");
+            return std::tuple_element_t<index, std::tuple<FIELDS...>>::WIDTHS[i];
+        }
+
+        // How many bits come before the field for member, so readers can skip straight to it.
+        template<auto MEMBER>
+        static constexpr size_t OffsetOf()
+        {
+            constexpr size_t index = IndexOf<MEMBER>();
+            static_assert(index < COUNT, "member isn't in the layout");
+            return OFFSETS[index];
+        }
+
+        // Writes every field from the one at index FIRST on.
+        template<size_t FIRST = 0>
+        static constexpr void Write(const WireState& state, BitStream::Writer& writer)
+        {
+            [&]<size_t... I>(std::index_sequence<I...>)
+            {
+                (std::tuple_element_t<FIRST + I, std::tuple<FIELDS...>>::Write(state, writer), ...);
+            }(std::make_index_sequence<COUNT - FIRST>());
+        }
+
+        // Reads every field from the one at index FIRST on.
+        template<size_t FIRST = 0>
+        static constexpr void Read(WireState& state, BitStream::Reader& reader)
+        {
+            [&]<size_t... I>(std::index_sequence<I...>)
+            {
+                (std::tuple_element_t<FIRST + I, std::tuple<FIELDS...>>::Read(state, reader), ...);
+            }(std::make_index_sequence<COUNT - FIRST>());
+        }
+
+    private:
+        template<typename FIELD, auto MEMBER>
+        static constexpr bool Matches()
+        {
+            if constexpr (std::is_same_v<std::remove_cv_t<decltype(FIELD::POINTER)>, decltype(MEMBER)>)
+            {
+                return FIELD::POINTER == MEMBER;
+            }
+            else
+            {
+                return false;
+            }
+        }
+    };
+
+    // the id always comes first, since it's also the start of every encoded state
+    using Layout = Fields<
+        Field<&WireState::id, 8>,
+        Field<&WireState::millis, 32>,
+        Field<&WireState::zone, 8>,
+        Field<&WireState::epoch, 8>,
+        Field<&WireState::location, 20>,
+        Field<&WireState::rotation, 11, 11, 12>>;
+
+    static_assert(Layout::IndexOf<&WireState::id>() == 0, "the id has to come first");
+    // the canonical layout is padded with zeros to a whole number of bytes
+    constexpr size_t STATE_LEN = (Layout::BITS + 7) / 8;
+
+    // Writes state in the canonical layout.
+    constexpr std::array<uint8_t, STATE_LEN> ToBytes(const WireState& state)
+    {
+        std::array<uint8_t, STATE_LEN> bytes{};
+        BitStream::Writer writer(bytes);
+        Layout::Write(state, writer);
+        writer.Align();
+        return bytes;
+    }
+
+    // Reads a state in the canonical layout.
+    constexpr WireState FromBytes(const std::array<uint8_t, STATE_LEN>& bytes)
+    {
+        WireState state{};
+        BitStream::Reader reader(bytes);
+        Layout::Read(state, reader);
+        return state;
+    }
+
+    // the state the golden fixture holds; keep it in sync with the description in the fixture
+    constexpr WireState GOLDEN_STATE{
+        .id = 7,
+        .millis = 0x01234567,
+        .zone = 0xcd,
+        .epoch = 42,
+        .location = { 150, -225, 102400 },
+        .rotation = { 16, 1024, 4095 },
+    };
+
+    constexpr std::string_view GOLDEN_HEX =
+#include "canonical-state.inc"
+        ;
+
+    constexpr std::array<uint8_t, STATE_LEN> GoldenBytes()
+    {
+        auto digit = [](char c) { return uint8_t(c <= '9' ? c - '0' : c - 'a' + 10); };
+        std::array<uint8_t, STATE_LEN> bytes{};
+        for (size_t i = 0; i < STATE_LEN; i++)
+        {
+            bytes[i] = uint8_t(digit(GOLDEN_HEX[2 * i]) << 4 | digit(GOLDEN_HEX[2 * i + 1]));
+        }
+        return bytes;
+    }
+
+    static_assert(GOLDEN_HEX.size() == STATE_LEN * 2, "the golden fixture is a different length than the layout");
+    static_assert(ToBytes(GOLDEN_STATE) == GoldenBytes(),
+        "the layout doesn't encode the golden state like the fixture");
+    static_assert(FromBytes(GoldenBytes()) == GOLDEN_STATE,
+        "the layout doesn't decode the fixture to the golden state");
+} // namespace StateSchema
@@ -1,14 +1,105 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
-#include <boost/bind.hpp>
+
+// Picks how packets are moved at compile time. On Linux, builds that define UDP_BATCHED_SYSCALLS (see the
+// PSEUDOREGALIA_MULTIPLAYER_BATCHED_UDP CMake option), e.g. for headless clients, move up to BATCH packets per syscall
+// with recvmmsg and sendmmsg. Everything else goes through asio one packet at a time.
+#if defined(UDP_BATCHED_SYSCALLS) && defined(__linux__)
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#define UDP_MMSG
+#endif
 
 namespace UdpSocket
 {
     using boost::asio::ip::udp;
 
-    // A simple wrapper around boost udp sockets with a similar interface to wswrap
+    // how many sends can be in flight at once; each has its own buffer, so Send never allocates. a send only takes
+    // as long as the OS needs to queue the packet, so this is plenty at the rates packets go out
+    constexpr size_t SEND_SLOTS = 8;
+    // how much memory asio gets for the state of each operation before it falls back to the heap
+    constexpr size_t HANDLER_MEMORY = 512;
+    // once a receive completes, packets already waiting are read straight off the socket, up to this many or for up
+    // to this long, before going back through asio. the budget keeps a backlog from holding up everything else the
+    // thread serving the socket does
+    constexpr size_t DRAIN_PACKETS = 64;
+    constexpr std::chrono::microseconds DRAIN_TIME(1000);
+    // the most packets one recvmmsg or sendmmsg moves
+    constexpr size_t BATCH = 16;
+
+    // Memory for the state asio keeps for one operation at a time, so an operation that's started over and over, like a
+    // receive, reuses the same memory instead of allocating each time.
+    class HandlerMemory
+    {
+    public:
+        void* Allocate(size_t size)
+        {
+            if (!_in_use && size <= _storage.size())
+            {
+                _in_use = true;
+                return _storage.data();
+            }
+            return ::operator new(size);
+        }
+
+        void Deallocate(void* pointer)
+        {
+            if (pointer == _storage.data())
+            {
+                _in_use = false;
+                return;
+            }
+            ::operator delete(pointer);
+        }
+
+    private:
+        alignas(std::max_align_t) std::array<unsigned char, HANDLER_MEMORY> _storage{};
+        bool _in_use = false;
+    };
+
+    // Hands asio the memory of a HandlerMemory; bound to a handler with boost::asio::bind_allocator.
+    template<typename T>
+    class HandlerAllocator
+    {
+    public:
+        typedef T value_type;
+
+        explicit HandlerAllocator(HandlerMemory& memory) : memory(&memory) {}
+
+        template<typename U>
+        HandlerAllocator(const HandlerAllocator<U>& other) : memory(other.memory) {}
+
+        T* allocate(size_t n)
+        {
+            return static_cast<T*>(memory->Allocate(sizeof(T) * n));
+        }
+
+        void deallocate(T* pointer, size_t)
+        {
+            memory->Deallocate(pointer);
+        }
+
+        template<typename U>
+        bool operator==(const HandlerAllocator<U>& other) const
+        {
+            return memory == other.memory;
+        }
+
+        HandlerMemory* memory;
+    };
+
+    // A simple wrapper around boost udp sockets, connected to an endpoint that's already been resolved and served by
+    // an io_context its owner runs. Once the first packet has been sent, sending and receiving don't allocate. With
+    // UDP_MMSG, sends are queued and go out together once the io_context gets to them, and each wakeup reads every
+    // waiting packet in as few syscalls as it can; the buffers and iovecs for both are set up once, here.
     template<size_t SEND, size_t RECV>
     class UdpSocket
     {
@@ -18,50 +109,213 @@ namespace UdpSocket
         typedef std::function<void(const boost::array<uint8_t, RECV>&, size_t)> on_recv_handler;
         typedef std::function<void(const std::string&)> on_err_handler;
 
-        UdpSocket(const std::string& address, const std::string& port, on_recv_handler on_recv, on_err_handler on_err)
-            : _socket(_io_service), _resolver(_io_service), _endpoint(*_resolver.resolve({ udp::v4(), address, port }))
-            , _on_recv(on_recv), _on_err(on_err)
+        UdpSocket(boost::asio::io_context& io, const udp::endpoint& endpoint, on_recv_handler on_recv,
+            on_err_handler on_err)
+            : _socket(io), _endpoint(endpoint), _on_recv(on_recv), _on_err(on_err)
         {
             _socket.open(udp::v4());
+            // so Drain can tell when there's nothing left to read
+            _socket.non_blocking(true);
+#if defined(UDP_MMSG)
+            for (size_t i = 0; i < BATCH; i++)
+            {
+                _recv_iovecs[i] = { _recv_bufs[i].data(), RECV };
+                _recv_msgs[i] = {};
+                _recv_msgs[i].msg_hdr.msg_iov = &_recv_iovecs[i];
+                _recv_msgs[i].msg_hdr.msg_iovlen = 1;
+
+                _send_iovecs[i] = { _send_bufs[i].data(), 0 };
+                _send_msgs[i] = {};
+                _send_msgs[i].msg_hdr.msg_name = _endpoint.data();
+                _send_msgs[i].msg_hdr.msg_namelen = socklen_t(_endpoint.size());
+                _send_msgs[i].msg_hdr.msg_iov = &_send_iovecs[i];
+                _send_msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+#endif
         }
 
+        // Copies the first len bytes of buf into a free send slot and sends them. The packet is dropped if every slot
+        // is still in flight.
         void Send(const boost::array<uint8_t, SEND>& buf, size_t len = SEND)
         {
-            auto shared_buf = std::make_shared<boost::array<uint8_t, SEND>>(buf);
-            // the buffer doesn't take ownership of the shared_ptr, so we pass it to HandleSend so it stays alive until
-            // the callback fires
-            _socket.async_send_to(boost::asio::buffer(*shared_buf, len), _endpoint,
-                boost::bind(&UdpSocket::HandleSend, this, shared_buf, boost::asio::placeholders::error));
+#if defined(UDP_MMSG)
+            if (_send_count == BATCH)
+            {
+                Flush();
+            }
+            std::copy_n(buf.begin(), len, _send_bufs[_send_count].begin());
+            _send_iovecs[_send_count].iov_len = len;
+            _send_count++;
+            if (!_flush_queued)
+            {
+                // everything sent before the io_context gets to this goes out with it
+                _flush_queued = true;
+                boost::asio::post(_socket.get_executor(),
+                    boost::asio::bind_allocator(HandlerAllocator<char>(_flush_memory),
+                        [this]()
+                        {
+                            _flush_queued = false;
+                            Flush();
+                        }));
+            }
+#else
+            auto& slot = _send_slots[_next_send_slot];
+            if (slot.in_flight)
+            {
+                _on_err("send: every buffer is still in flight");
+                return;
+            }
+            _next_send_slot = (_next_send_slot + 1) % SEND_SLOTS;
+
+            slot.in_flight = true;
+            std::copy_n(buf.begin(), len, slot.buf.begin());
+            _socket.async_send_to(boost::asio::buffer(slot.buf, len), _endpoint,
+                boost::asio::bind_allocator(HandlerAllocator<char>(slot.memory),
+                    [this, &slot](const boost::system::error_code& error, std::size_t)
+                    {
+                        HandleSend(slot, error);
+                    }));
+#endif
         }
 
-        void Poll()
+        // Stops sending and receiving. The handlers of operations still pending run once more and see they were
+        // aborted, so the socket should only be deleted after the io_context has run them.
+        void Close()
         {
-            _io_service.poll();
-            // TODO is the reset necessary?
-            _io_service.reset();
+            boost::system::error_code ignored;
+            _socket.close(ignored);
         }
 
     private:
-        boost::asio::io_service _io_service;
+        // a buffer for one send, which stays in use until the send completes
+        struct SendSlot
+        {
+            boost::array<uint8_t, SEND> buf{};
+            HandlerMemory memory;
+            bool in_flight = false;
+        };
+
         udp::socket _socket;
-        udp::resolver _resolver;
         udp::endpoint _endpoint;
         udp::endpoint _sender_endpoint;
-        boost::array<uint8_t, RECV> _recv_buf{};
+        HandlerMemory _recv_memory;
         bool _started_receive = false;
+#if defined(UDP_MMSG)
+        std::array<boost::array<uint8_t, RECV>, BATCH> _recv_bufs{};
+        std::array<iovec, BATCH> _recv_iovecs{};
+        std::array<mmsghdr, BATCH> _recv_msgs{};
+        // the sends queued since the last Flush
+        std::array<boost::array<uint8_t, SEND>, BATCH> _send_bufs{};
+        std::array<iovec, BATCH> _send_iovecs{};
+        std::array<mmsghdr, BATCH> _send_msgs{};
+        size_t _send_count = 0;
+        HandlerMemory _flush_memory;
+        bool _flush_queued = false;
+#else
+        boost::array<uint8_t, RECV> _recv_buf{};
+        std::array<SendSlot, SEND_SLOTS> _send_slots{};
+        size_t _next_send_slot = 0;
+#endif
 
         on_recv_handler _on_recv;
         on_err_handler _on_err;
 
+#if defined(UDP_MMSG)
+        // Waits for packets to arrive, then reads them all at once.
+        void StartReceive()
+        {
+            _socket.async_wait(udp::socket::wait_read,
+                boost::asio::bind_allocator(HandlerAllocator<char>(_recv_memory),
+                    [this](const boost::system::error_code& error)
+                    {
+                        HandleReadable(error);
+                    }));
+        }
+
+        void HandleReadable(const boost::system::error_code& error)
+        {
+            if (error == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
+            if (error)
+            {
+                std::string message = error.message();
+                _on_err("recv: " + message);
+            }
+            else
+            {
+                Drain();
+            }
+            StartReceive();
+        }
+
+        // Handles the packets that are already waiting, within the drain budget, BATCH at a time.
+        void Drain()
+        {
+            auto deadline = std::chrono::steady_clock::now() + DRAIN_TIME;
+            size_t handled = 0;
+            while (handled < DRAIN_PACKETS && std::chrono::steady_clock::now() < deadline)
+            {
+                auto wanted = unsigned(std::min(BATCH, DRAIN_PACKETS - handled));
+                int received = recvmmsg(_socket.native_handle(), _recv_msgs.data(), wanted, MSG_DONTWAIT, nullptr);
+                if (received < 0)
+                {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    {
+                        _on_err("recv: " + std::string(std::strerror(errno)));
+                    }
+                    return;
+                }
+                for (int i = 0; i < received; i++)
+                {
+                    _on_recv(_recv_bufs[i], _recv_msgs[i].msg_len);
+                }
+                handled += size_t(received);
+                if (unsigned(received) < wanted)
+                {
+                    return;
+                }
+            }
+        }
+
+        // Sends everything queued since the last call in one syscall. Packets the socket won't take are dropped.
+        void Flush()
+        {
+            if (_send_count == 0 || !_socket.is_open())
+            {
+                return;
+            }
+            int sent = sendmmsg(_socket.native_handle(), _send_msgs.data(), unsigned(_send_count), 0);
+            if (sent < int(_send_count))
+            {
+                _on_err("send: " + std::string(sent < 0 ? std::strerror(errno) : "not every packet was sent"));
+            }
+            _send_count = 0;
+
+            if (!_started_receive)
+            {
+                StartReceive();
+                _started_receive = true;
+            }
+        }
+#else
         void StartReceive()
         {
             _socket.async_receive_from(boost::asio::buffer(_recv_buf), _sender_endpoint,
-                boost::bind(&UdpSocket::HandleReceive, this, boost::asio::placeholders::error,
-                    boost::asio::placeholders::bytes_transferred));
+                boost::asio::bind_allocator(HandlerAllocator<char>(_recv_memory),
+                    [this](const boost::system::error_code& error, std::size_t len)
+                    {
+                        HandleReceive(error, len);
+                    }));
         }
 
         void HandleReceive(const boost::system::error_code& error, std::size_t len)
         {
+            if (error == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
             if (!error || error == boost::asio::error::message_size)
             {
                 _on_recv(_recv_buf, len);
@@ -71,11 +325,39 @@ namespace UdpSocket
                 std::string message = error.message();
                 _on_err("recv: " + message);
             }
+            Drain();
             StartReceive();
         }
 
-        void HandleSend(std::shared_ptr<boost::array<uint8_t, SEND>>, const boost::system::error_code& error)
+        // Handles the packets that are already waiting, within the drain budget.
+        void Drain()
+        {
+            auto deadline = std::chrono::steady_clock::now() + DRAIN_TIME;
+            for (size_t i = 0; i < DRAIN_PACKETS && std::chrono::steady_clock::now() < deadline; i++)
+            {
+                boost::system::error_code error;
+                size_t len = _socket.receive_from(boost::asio::buffer(_recv_buf), _sender_endpoint, 0, error);
+                if (error == boost::asio::error::would_block)
+                {
+                    return;
+                }
+                if (error && error != boost::asio::error::message_size)
+                {
+                    std::string message = error.message();
+                    _on_err("recv: " + message);
+                    return;
+                }
+                _on_recv(_recv_buf, len);
+            }
+        }
+
+        void HandleSend(SendSlot& slot, const boost::system::error_code& error)
         {
+            slot.in_flight = false;
+            if (error == boost::asio::error::operation_aborted)
+            {
+                return;
+            }
             if (error)
             {
                 std::string message = error.message();
@@ -90,5 +372,6 @@ namespace UdpSocket
             }
 
         }
+#endif
     };
 } // namespace UdpSocket
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace ZoneBounds
+{
+    // The box locations in a zone are quantized into: its centre, and the distance between neighbouring quantized
+    // values along each axis, in world units. A location field holds the signed number of steps from the centre.
+    struct Box
+    {
+        std::array<float, 3> center;
+        float step;
+    };
+
+    // Returns the box for zone.
+    const Box& For(uint32_t zone);
+    // Quantizes location into zone's box, clamping any axis that falls outside it to the nearest edge. Returns whether
+    // every axis was inside.
+    bool Quantize(uint32_t zone, const std::array<double, 3>& location, std::array<int32_t, 3>& quantized);
+    // Maps a location quantized in zone's box back to world units.
+    std::array<float, 3> Dequantize(uint32_t zone, const std::array<int32_t, 3>& quantized);
+} // namespace ZoneBounds
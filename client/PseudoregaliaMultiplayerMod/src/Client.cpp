@@ -2,236 +2,161 @@
 
 #include "Client.hpp"
 
+#include <algorithm>
 #include <bit>
 #include <chrono>
+#include <cmath>
 #include <codecvt>
-#include <queue>
-
-#define WSWRAP_NO_SSL
-#define WSWRAP_NO_COMPRESSION
-#define WSWRAP_SEND_EXCEPTIONS
-#define ASIO_STANDALONE
-#define BOOST_ALL_NO_LIB
-#include "wswrap.hpp"
-#include "nlohmann/json.hpp"
+#include <locale>
+#include <unordered_set>
 
 #include "Unreal/FString.hpp"
 
 #include "Logger.hpp"
+#include "ClockSync.hpp"
+#include "GhostTable.hpp"
+#include "Interpolator.hpp"
+#include "NetThread.hpp"
 #include "Settings.hpp"
-#include "UdpSocket.hpp"
 
 namespace
 {
-    const size_t STATE_LEN = 24;
-    const size_t MAX_STATES_PER_PACKET = 21;
-    const size_t MIN_SERVER_PACKET_LEN = STATE_LEN;
-    const size_t MAX_SERVER_PACKET_LEN = MAX_STATES_PER_PACKET * STATE_LEN;
-
-    const size_t SEND = MIN_SERVER_PACKET_LEN;
-    const size_t RECV = MAX_SERVER_PACKET_LEN;
-
-    void OnOpen();
-    void OnClose();
-    void OnMessage(const std::string&);
-    void OnError(const std::string&);
-
-    void OnRecv(const boost::array<uint8_t, RECV>&, size_t);
-    void OnErr(const std::string&);
-
     std::wstring ToWide(const std::string&);
-    uint32_t HashW(const std::wstring&);
+    std::string ToUtf8(const std::wstring&);
 
     RC::Unreal::FString ToFString(const std::string& input);
 
     typedef std::chrono::steady_clock::time_point steady_time_point;
-    uint32_t MillisSinceStart(const steady_time_point&);
+    steady_time_point Now();
+    double LocalMillis(const steady_time_point&);
+    double ServerMillis(const steady_time_point&);
+    uint32_t ToStamp(double);
     steady_time_point AdvanceNanos();
+    void PushScene();
+    void HandleEvents();
+    void HandleSamples();
+    void DetectTeleport(const FST_PlayerInfo&);
     bool TrySendUpdate(const FST_PlayerInfo&, const uint32_t&);
     void SendUpdate(const FST_PlayerInfo&, const uint32_t&);
 
-    void SerializeU8(uint8_t, boost::array<uint8_t, SEND>&, size_t&);
-    void SerializeU32(uint32_t, boost::array<uint8_t, SEND>&, size_t&);
-    void SerializeF32(float, boost::array<uint8_t, SEND>&, size_t&);
-    void SerializeLocator(double, boost::array<uint8_t, SEND>&, size_t&);
-    void SerializeRotator(double, boost::array<uint8_t, SEND>&, size_t&);
-
-    uint8_t DeserializeU8(const boost::array<uint8_t, RECV>&, size_t&);
-    uint32_t DeserializeU32(const boost::array<uint8_t, RECV>&, size_t&);
-    float DeserializeF32(const boost::array<uint8_t, RECV>&, size_t&);
-    double DeserializeLocator(const boost::array<uint8_t, RECV>&, size_t&);
-    double DeserializeRotator(const boost::array<uint8_t, RECV>&, size_t&);
-
     bool queue_connect = false;
     bool queue_disconnect = false;
-    wswrap::WS* ws = nullptr;
-    UdpSocket::UdpSocket<SEND, RECV>* udp = nullptr;
-
-    const size_t MAX_STATES = 20;
-    const size_t MAX_OFFSETS = 100;
-
-    // some value in milliseconds to buffer when calculating millis to use for ghosts; causes delay, which can
-    // allow more time for packets to arrive
-    // TODO make this configurable, or auto calculate per ghost?
-    const int64_t GHOST_MILLIS_BUFFER = 100;
 
-    struct State
-    {
-        FST_PlayerInfo info;
-        uint32_t zone;
-        uint32_t millis;
-    };
+    // ghosts are only passed to the bp mod when they spawn, their identity changes, or they move more than this (in cm
+    // and degrees) from the pose it was last given, so the payload scales with how much is moving
+    const float EMIT_LOCATION_CHANGE = 0.1f;
+    const float EMIT_ROTATION_CHANGE = 0.01f;
 
+    // the identity of a ghost; its states live in ghost_table, in the slot with the same index
     struct Ghost
     {
         uint8_t id = 0;
         std::array<uint8_t, 3> color{};
         RC::Unreal::FString name;
-        std::list<State> states;
-
-        // offsets provide a way to figure out syncing. the offset is meant to guess at how far off a player's
-        // millisecond counter is from our own. these two fields let us easily check the average offset over the last
-        // MAX_OFFSETS messages received
-        int64_t total_offset = 0;
-        std::deque<uint64_t> offsets;
-
-        State cached_state{};
-
-        bool can_insert(uint32_t ghost_millis) const
+        // the playout delay last written to the log, in milliseconds
+        float reported_delay = 0.0f;
+        // the pose the bp mod was last given for this ghost, and whether it has to be given the ghost again even if
+        // the pose hasn't changed, e.g. because its identity has
+        GhostTable::State emitted{};
+        bool dirty = true;
+
+        // builds the info passed to the bp mod from a state, attaching this ghost's identity
+        FST_PlayerInfo to_info(const GhostTable::State& s) const
         {
-            auto eq = [&](const State& state) { return state.millis == ghost_millis; };
-            return std::find_if(states.begin(), states.end(), eq) == states.end()
-                && (states.size() < MAX_STATES || states.front().millis < ghost_millis);
+            return FST_PlayerInfo
+            {
+                .location_x = s.location[0],
+                .location_y = s.location[1],
+                .location_z = s.location[2],
+                .rotation_x = s.rotation[0],
+                .rotation_y = s.rotation[1],
+                .rotation_z = s.rotation[2],
+                .name = name,
+                .id = id,
+                .red = color[0],
+                .green = color[1],
+                .blue = color[2],
+            };
         }
 
-        // should only be called if can_insert returns true; otherwise states can include duplicates or this function
-        // can be unnecessarily called with a state that would be dropped anyway
-        void insert(State& s, const uint32_t& millis)
+        // whether s is far enough from the last pose given to the bp mod to be worth giving it again
+        bool moved_from_emitted(const GhostTable::State& s) const
         {
-            // this is a new latest state, so update offset calculation
-            if (states.size() == 0 || s.millis > states.back().millis)
+            for (size_t i = 0; i < 3; i++)
             {
-                int64_t offset = int64_t(s.millis) - int64_t(millis);
-                total_offset += offset;
-                offsets.push_back(offset);
-                if (offsets.size() > MAX_OFFSETS)
+                if (std::abs(s.location[i] - emitted.location[i]) > EMIT_LOCATION_CHANGE
+                    || std::abs(s.rotation[i] - emitted.rotation[i]) > EMIT_ROTATION_CHANGE)
                 {
-                    total_offset -= offsets.front();
-                    offsets.pop_front();
+                    return true;
                 }
             }
-            
-            s.info.name = name;
-            s.info.id = id;
-            s.info.red = color[0];
-            s.info.green = color[1];
-            s.info.blue = color[2];
-
-            // insert after the first element that has a lower millis to keep the list sorted
-            // reverse find because we're more likely to be inserting towards the back of the list
-            auto less = [&](const State& state) { return state.millis < s.millis; };
-            auto it = std::find_if(states.rbegin(), states.rend(), less);
-            states.insert(it.base(), s);
-
-            if (states.size() > MAX_STATES)
-            {
-                states.pop_front();
-            }
-        }
-
-        const State& get_state() const
-        {
-            return cached_state;
-        }
-
-        std::optional<State> refresh_state(const uint32_t& millis)
-        {
-            if (states.size() == 0 || offsets.size() == 0)
-            {
-                return {};
-            }
-
-            int64_t average_offset = total_offset / int64_t(offsets.size());
-            uint32_t ghost_millis = uint32_t(int64_t(millis) + average_offset - GHOST_MILLIS_BUFFER);
-            cached_state = get_closest(ghost_millis);
-            return cached_state;
-        }
-
-        State get_closest(const uint32_t& ghost_millis) const
-        {
-            if (ghost_millis <= states.front().millis)
-            {
-                return states.front();
-            }
-            if (ghost_millis >= states.back().millis)
-            {
-                return states.back();
-            }
-
-            auto ge = [&](const State& state) { return state.millis >= ghost_millis; };
-            auto it = std::find_if(states.cbegin(), states.cend(), ge);
-            const State& upper = *it;
-            --it;
-            const State& lower = *it;
-
-            uint32_t lower_dist = ghost_millis - lower.millis;
-            uint32_t upper_dist = upper.millis - ghost_millis;
-            bool lower_is_closer = lower_dist < upper_dist;
-            if (lower.zone != upper.zone)
-            {
-                // if the two closest states differ by zone, just return the closer one
-                return lower_is_closer ? lower : upper;
-            }
-
-            // distance from lower as a percentage
-            double pct = double(lower_dist) / double(lower_dist + upper_dist);
-            return State
-            {
-                .info = FST_PlayerInfo
-                {
-                    // interpolate location between lower and upper based on percent
-                    .location_x = lower.info.location_x + (upper.info.location_x - lower.info.location_x) * pct,
-                    .location_y = lower.info.location_y + (upper.info.location_y - lower.info.location_y) * pct,
-                    .location_z = lower.info.location_z + (upper.info.location_z - lower.info.location_z) * pct,
-                    // don't sweat interpolating rotation, just take the closer one
-                    .rotation_x = lower_is_closer ? lower.info.rotation_x : upper.info.rotation_x,
-                    .rotation_y = lower_is_closer ? lower.info.rotation_y : upper.info.rotation_y,
-                    .rotation_z = lower_is_closer ? lower.info.rotation_z : upper.info.rotation_z,
-                    .name = name,
-                    .id = id,
-                    .red = color[0],
-                    .green = color[1],
-                    .blue = color[2],
-                },
-                .zone = lower.zone,
-                .millis = ghost_millis,
-            };
+            return false;
         }
     };
 
-    uint32_t current_zone;
+    void AddGhost(uint8_t, const std::string&, const std::array<uint8_t, 3>&);
+    void ReportDelay(size_t);
+    void ReportPlayout();
+
+    // the playout delay of a ghost is logged whenever it moves at least this many milliseconds from the last value
+    // that was logged
+    const float REPORT_DELAY_CHANGE = 10.0f;
+    // whether ghosts were playing faster or slower than real time when last logged, and how many times the playout
+    // delay had jumped
+    bool reported_catching_up = false;
+    uint32_t reported_playout_jumps = 0;
+
+    // where the current time comes from; steady_clock unless something else is injected
+    Client::TimeSource time_source = std::chrono::steady_clock::now;
+    // the time of the current frame on the shared timeline, taken once per tick so every ghost is evaluated at the
+    // same instant no matter when or how often the bp mod asks for them
+    std::optional<double> frame_millis = {};
+
+    // the level we're in. the network thread registers it with the server and tells us the index it gets, which is
+    // what ghosts are compared against; until then no updates are sent, and no ghosts are shown
+    std::string current_zone_name;
+    std::optional<uint8_t> current_zone_index = {};
+    // bumped whenever we teleport, so other clients know not to interpolate across the jump. a teleport is any move
+    // of more than TELEPORT_DISTANCE (in cm) between two frames, which is far faster than anything can actually move
+    uint8_t epoch = 0;
+    const double TELEPORT_DISTANCE = 1000.0;
+    std::optional<std::array<double, 3>> last_location = {};
     // if an update isn't ready to be sent when created, it gets stored here
     std::optional<std::pair<FST_PlayerInfo, uint32_t>> queued_update = {};
 
     // the id given in the Connected message; this value being defined means a full connection has been established
     std::optional<uint8_t> id = {};
-    std::unordered_map<uint8_t, Ghost> ghosts = {};
+    GhostTable::GhostTable ghost_table;
+    std::array<Ghost, GhostTable::MAX_GHOSTS> ghosts = {};
     std::unordered_set<uint8_t> spawned_ghosts = {};
 
-    // about 1/60 seconds, in nanoseconds because that's what steady_clock uses
-    const int64_t NANOS_PER_UPDATE = 16666667;
-    // the first value marks the time the first update was sent after connecting; the second value marks the last time
-    // the client checked if it could send an update and is used to increment nanos
-    std::optional<std::pair<steady_time_point, steady_time_point>> timers = {};
+    // about 1/30 seconds, in nanoseconds because that's what steady_clock uses. ghosts are smoothed with Hermite
+    // curves by default, so this doesn't need to match the frame rate
+    const int64_t NANOS_PER_UPDATE = 33333333;
+    // marks the last time the client checked if it could send an update and is used to increment nanos; this value
+    // being defined means the first update after connecting has been sent
+    std::optional<steady_time_point> update_timer = {};
     // keeps track of nanoseconds accrued for updates; an update can only be fired if it exceeds NANOS_PER_UPDATE
     int64_t nanos = 0;
+
+    // states and the frames ghosts are drawn at are stamped with the server's millisecond counter, so every ghost
+    // shares one timeline no matter when its player connected. our own millis count from when the connection opened
+    // and are converted with server_clock, which is fed the same pongs as the network thread's
+    ClockSync::ClockSync server_clock;
+    steady_time_point clock_start;
+
+    // the samples taken off the ring in one tick, which can be all of them after a hitch, and how many each player
+    // has among them that haven't been looked at yet
+    std::array<NetThread::Sample, NetThread::SAMPLE_RING> pending_samples;
+    std::array<uint16_t, 256> pending_per_player{};
 }
 
 void Client::OnSceneLoad(std::wstring level)
 {
     // we clear spawned_ghosts here because being in a new scene means they're all gone anyway
     spawned_ghosts.clear();
-    current_zone = HashW(level);
+    current_zone_name = ToUtf8(level);
+    current_zone_index.reset();
     if (level == L"TitleScreen" || level == L"EndScreen")
     {
         queue_disconnect = true;
@@ -239,6 +164,10 @@ void Client::OnSceneLoad(std::wstring level)
     else
     {
         queue_connect = true;
+        if (NetThread::Running())
+        {
+            PushScene();
+        }
     }
 }
 
@@ -246,65 +175,57 @@ void Client::Tick()
 {
     if (queue_disconnect)
     {
-        if (ws)
+        if (NetThread::Running())
         {
-            delete ws;
-            ws = nullptr;
-            delete udp;
-            udp = nullptr;
+            NetThread::Stop();
 
             id.reset();
-            ghosts.clear();
+            ghost_table.Clear();
             // don't clear spawned_ghosts because we need to tell the bp mod to delete the actors
 
-            timers.reset();
+            update_timer.reset();
             nanos = 0;
+            frame_millis.reset();
+            last_location.reset();
+            queued_update.reset();
+            reported_catching_up = false;
+            reported_playout_jumps = 0;
+            server_clock.Clear();
+            current_zone_index.reset();
         }
         queue_disconnect = false;
     }
     if (queue_connect)
     {
-        if (!ws)
+        if (NetThread::Running())
         {
-            const auto& address = Settings::GetAddress();
-            const auto& port = Settings::GetPort();
-            auto uri = "ws://" + address + ":" + port;
-            try
-            {
-                ws = new wswrap::WS(uri, OnOpen, OnClose, OnMessage, OnError);
-            }
-            catch (const boost::system::system_error& ex)
-            {
-                ws = nullptr;
-                Log(L"Error creating WebSocket: " + ToWide(ex.code().message()), LogType::Error);
-            }
-            catch (const std::exception& ex)
-            {
-                ws = nullptr;
-                Log(L"Error creating WebSocket: " + ToWide(ex.what()), LogType::Error);
-            }
-            try
-            {
-                udp = new UdpSocket::UdpSocket<SEND, RECV>(address, port, OnRecv, OnErr);
-            }
-            catch (const boost::system::system_error& ex)
-            {
-                delete ws;
-                ws = nullptr;
-                udp = nullptr;
-                Log(L"Error creating UDP socket: " + ToWide(ex.code().message()), LogType::Error);
-            }
-            catch (const std::exception& ex)
+            queue_connect = false;
+        }
+        // if the last connection's thread is still finishing, this is tried again next frame
+        else if (clock_start = Now(); NetThread::Start(time_source, clock_start))
+        {
+            const auto& interpolation = Settings::GetInterpolation();
+            auto kind = Interpolator::ParseKind(interpolation);
+            if (!kind)
             {
-                delete ws;
-                ws = nullptr;
-                udp = nullptr;
-                Log(L"Error creating UDP socket: " + ToWide(ex.what()), LogType::Error);
+                Log(L"Unknown interpolation \"" + ToWide(interpolation) + L"\", using hermite", LogType::Warning);
+                kind = Interpolator::Kind::Hermite;
             }
+            ghost_table.SetInterpolator(Interpolator::Create(*kind));
+            ghost_table.SetMaxExtrapolation(Settings::GetMaxExtrapolation());
+
+            PushScene();
+            queue_connect = false;
         }
-        queue_connect = false;
     }
-    if (id && timers)
+    // everything the network thread got since the last frame; it did the decoding, so this is cheap. a stopped
+    // thread's leftovers are dropped instead, when the next one starts
+    if (NetThread::Running())
+    {
+        HandleEvents();
+        HandleSamples();
+    }
+    if (id && update_timer)
     {
         AdvanceNanos();
         if (queued_update)
@@ -316,61 +237,90 @@ void Client::Tick()
             }
         }
     }
-    if (ws)
+    if (id && server_clock.Ready())
+    {
+        frame_millis = ServerMillis(Now());
+    }
+}
+
+void Client::SetTimeSource(TimeSource source)
+{
+    // both threads have to stamp our own millis off the same clock
+    if (NetThread::Running())
     {
-        ws->poll();
-        udp->Poll();
+        Log(L"Can't change the time source while connected", LogType::Warning);
+        return;
     }
+    time_source = std::move(source);
 }
 
-uint32_t Client::SetPlayerInfo(const FST_PlayerInfo& info)
+void Client::SetPlayerInfo(const FST_PlayerInfo& info)
 {
-    if (!id)
+    if (!id || !server_clock.Ready() || !current_zone_index)
     {
-        return 0u;
+        return;
     }
-    if (timers)
+    DetectTeleport(info);
+    if (update_timer)
     {
         auto now = AdvanceNanos();
-        auto millis = MillisSinceStart(now);
+        auto millis = ToStamp(ServerMillis(now));
         bool sent = TrySendUpdate(info, millis);
         if (!sent)
         {
             queued_update = { info, millis };
         }
-        return millis;
     }
     else
     {
-        auto now = std::chrono::steady_clock::now();
-        timers = { now, now };
-        SendUpdate(info, 0u);
-        return 0u;
+        auto now = Now();
+        update_timer = now;
+        SendUpdate(info, ToStamp(ServerMillis(now)));
     }
 }
 
-void Client::GetGhostInfo(
-    const uint32_t& millis,
-    RC::Unreal::FScriptArray& ghost_info_raw,
-    RC::Unreal::TArray<uint8_t>& to_remove
-) {
+void Client::GetGhostInfo(RC::Unreal::FScriptArray& ghost_info_raw, RC::Unreal::TArray<uint8_t>& to_remove)
+{
     auto& ghost_info = *reinterpret_cast<RC::Unreal::TArray<FST_PlayerInfo>*>(&ghost_info_raw);
+    // the arrays are reused between calls, so empty them while keeping their allocations
+    ghost_info.Reset();
+    to_remove.Reset();
 
-    for (auto& [id, ghost] : ghosts)
+    if (frame_millis)
     {
-        const auto& state = ghost.refresh_state(millis);
-        if (!state || state->zone != current_zone)
+        ghost_table.Update(*frame_millis);
+        ReportPlayout();
+    }
+    for (uint32_t slots = ghost_table.ActiveSlots(); slots != 0; slots &= slots - 1)
+    {
+        size_t slot = size_t(std::countr_zero(slots));
+        ReportDelay(slot);
+        if (!ghost_table.HasPose(slot))
+        {
+            continue;
+        }
+        const auto& state = ghost_table.GetPose(slot);
+        if (state.zone != current_zone_index)
         {
             continue;
         }
 
-        ghost_info.Add(state->info);
-        spawned_ghosts.insert(id);
+        // ghosts that are already spawned only need to be passed again if something about them changed
+        auto& ghost = ghosts[slot];
+        if (!ghost.dirty && !ghost.moved_from_emitted(state) && spawned_ghosts.contains(ghost.id))
+        {
+            continue;
+        }
+        ghost_info.Add(ghost.to_info(state));
+        ghost.emitted = state;
+        ghost.dirty = false;
+        spawned_ghosts.insert(ghost.id);
     }
 
     for (auto it = spawned_ghosts.begin(); it != spawned_ghosts.end(); )
     {
-        if (!ghosts.contains(*it) || ghosts.at(*it).get_state().zone != current_zone)
+        auto slot = ghost_table.SlotOf(*it);
+        if (!slot || !ghost_table.HasPose(*slot) || ghost_table.GetPose(*slot).zone != current_zone_index)
         {
             to_remove.Add(*it);
             it = spawned_ghosts.erase(it);
@@ -385,289 +335,228 @@ void Client::GetGhostInfo(
 namespace
 {
 
-void OnOpen()
-{
-    Log(L"WebSocket connection established", LogType::Loud);
-    const auto& color = Settings::GetColor();
-    const auto& name = Settings::GetName();
-    nlohmann::json j = {
-        {"type", "Connect"},
-        {"color", color},
-        {"name", name},
-    };
-    ws->send_text(j.dump());
-}
-
-void OnClose()
+// Tells the network thread which zone we're in.
+void PushScene()
 {
-    Log(L"Disconnected from server", LogType::Loud);
-    queue_disconnect = true;
+    NetThread::Command command{ .kind = NetThread::Command::Kind::SceneLoad, .zone_name = current_zone_name };
+    if (!NetThread::Push(command))
+    {
+        Log(L"Could not tell the network thread about zone " + ToWide(current_zone_name), LogType::Warning);
+    }
 }
 
-void OnMessage(const std::string& message)
+// Handles the events the network thread has sent since the last call.
+void HandleEvents()
 {
-    // TODO add schema validation? this function assumes a valid message
-    nlohmann::json j = nlohmann::json::parse(message);
-    const auto& field_type = j["type"];
-    if (field_type == "Connected")
+    NetThread::Event event;
+    while (NetThread::PopEvent(event))
     {
-        if (id)
+        switch (event.kind)
         {
-            Log(L"Received Connected message after connection was already established", LogType::Warning);
-            queue_disconnect = true;
-            return;
-        }
-
-        id = j["id"].template get<uint8_t>();
-
-        auto& field_players = j["players"];
-        for (auto it = field_players.begin(); it != field_players.end(); ++it)
-        {
-            auto player_name = (*it)["name"].template get<std::string>();
-            auto player_id = (*it)["id"].template get<uint8_t>();
-
-            const auto& field_color = (*it)["color"];
-            auto red = field_color[0].template get<uint8_t>();
-            auto green = field_color[1].template get<uint8_t>();
-            auto blue = field_color[2].template get<uint8_t>();
-            
-            ghosts[player_id] = Ghost
+        case NetThread::Event::Kind::Connected:
+            id = event.id;
+            break;
+        case NetThread::Event::Kind::PlayerJoined:
+            AddGhost(event.id, event.name, event.color);
+            break;
+        case NetThread::Event::Kind::PlayerLeft:
+            ghost_table.Remove(event.id);
+            break;
+        case NetThread::Event::Kind::ZoneIndex:
+            // it may be for a zone we've already left
+            if (event.name == current_zone_name)
             {
-                .id = player_id,
-                .color = { red, green, blue },
-                .name = ToFString(player_name)
-            };
-        }
-
-        Log(L"Received Connected message with player id " + std::to_wstring(*id), LogType::Loud);
-    }
-    else if (field_type == "PlayerJoined")
-    {
-        if (!id)
+                current_zone_index = event.zone;
+            }
+            break;
+        case NetThread::Event::Kind::ZoneRejected:
+            // without an index we can't send updates or show ghosts, so say why instead of waiting for one
+            if (event.name == current_zone_name)
+            {
+                Log(L"The server can't share zone " + ToWide(event.name) + L" (" + ToWide(event.reason)
+                        + L"), so other players won't see you or be shown until you leave it",
+                    LogType::Warning);
+            }
+            break;
+        case NetThread::Event::Kind::Pong:
         {
-            Log(L"Received PlayerJoined message before Connected message", LogType::Warning);
-            queue_disconnect = true;
-            return;
+            bool was_ready = server_clock.Ready();
+            server_clock.OnPong(event.sent, event.server_millis, event.received);
+            if (!was_ready && server_clock.Ready())
+            {
+                Log(L"Synced clock with server, round trip " + std::to_wstring(server_clock.Rtt()) + L" ms",
+                    LogType::Loud);
+            }
+            break;
         }
-
-        auto player_name = j["name"].template get<std::string>();
-        auto player_id = j["id"].template get<uint8_t>();
-
-        const auto& field_color = j["color"];
-        auto red = field_color[0].template get<uint8_t>();
-        auto green = field_color[1].template get<uint8_t>();
-        auto blue = field_color[2].template get<uint8_t>();
-        
-        ghosts[player_id] = Ghost{ .id = player_id, .color = { red, green, blue }, .name = ToFString(player_name)};
-
-        Log(L"Received PlayerJoined message with id " + std::to_wstring(player_id) + L" (" + ToWide(player_name) + L")",
-            LogType::Loud);
-    }
-    else if (field_type == "PlayerLeft")
-    {
-        if (!id)
-        {
-            Log(L"Received PlayerLeft message before Connected message", LogType::Warning);
+        case NetThread::Event::Kind::Closed:
             queue_disconnect = true;
-            return;
+            break;
         }
-
-        auto player_id = j["id"].template get<uint8_t>();
-        ghosts.erase(player_id);
-
-        Log(L"Received PlayerLeft message with id " + std::to_wstring(player_id), LogType::Loud);
     }
 }
 
-void OnError(const std::string& error_message)
-{
-    Log(L"WebSocket error: " + ToWide(error_message), LogType::Error);
-}
-
-void OnRecv(const boost::array<uint8_t, RECV>& buf, size_t len)
+// Inserts the states the network thread has decoded since the last call into ghost_table. After a hitch there can be
+// more of them for a ghost than it keeps, so only the last GhostTable::MAX_STATES of each player's to arrive are
+// looked at, and of those, only the ones the ghost doesn't already have or would drop right away are inserted.
+void HandleSamples()
 {
-    if (len < MIN_SERVER_PACKET_LEN || len > MAX_SERVER_PACKET_LEN || len % STATE_LEN != 0)
+    size_t count = 0;
+    while (count < pending_samples.size() && NetThread::PopSample(pending_samples[count]))
     {
-        Log(L"Received packet of invalid size " + std::to_wstring(len), LogType::Warning);
-        return;
+        pending_per_player[pending_samples[count].id]++;
+        count++;
     }
 
-    if (!timers)
+    for (size_t i = 0; i < count; i++)
     {
-        return;
-    }
-    auto millis = MillisSinceStart(std::chrono::steady_clock::now());
-
-    size_t pos = 0;
-    size_t num_updates = len / STATE_LEN;
-    for (size_t i = 0; i < num_updates; i++)
-    {
-        uint8_t player_id = DeserializeU8(buf, pos);
-        if (!ghosts.contains(player_id))
+        const auto& sample = pending_samples[i];
+        // superseded by later samples in this batch
+        if (pending_per_player[sample.id]-- > GhostTable::MAX_STATES)
         {
-            // skip pos ahead the bytes it would have read for this player
-            pos += 19;
             continue;
         }
-        auto& ghost = ghosts.at(player_id);
-
-        uint32_t ghost_millis = DeserializeU32(buf, pos);
-        if (!ghost.can_insert(ghost_millis))
+        auto slot = ghost_table.SlotOf(sample.id);
+        if (slot && ghost_table.CanInsert(*slot, sample.state.millis))
         {
-            pos += 15;
-            continue;
+            ghost_table.Insert(*slot, sample.state, sample.millis);
         }
-
-        State state{};
-        state.millis = ghost_millis;
-        state.zone = DeserializeU32(buf, pos);
-        state.info.location_x = DeserializeLocator(buf, pos);
-        state.info.location_y = DeserializeLocator(buf, pos);
-        state.info.location_z = DeserializeLocator(buf, pos);
-        state.info.rotation_x = DeserializeRotator(buf, pos);
-        state.info.rotation_y = DeserializeRotator(buf, pos);
-        state.info.rotation_z = DeserializeRotator(buf, pos);
-        ghost.insert(state, millis);
     }
 }
 
-void OnErr(const std::string& error_message)
-{
-    Log(L"UDP error: " + ToWide(error_message), LogType::Error);
-    // TODO should we disconnect here?
-}
-
-std::wstring ToWide(const std::string& input)
-{
-    static std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
-    return converter.from_bytes(input);
-}
-
-// Performs the 32-bit FNV-1a hash function on the input wstring.
-uint32_t HashW(const std::wstring& str)
+// Claims a slot in ghost_table for the player and records their identity.
+void AddGhost(uint8_t player_id, const std::string& player_name, const std::array<uint8_t, 3>& color)
 {
-    static_assert(sizeof(wchar_t) == 2);
-
-    uint32_t result = 0x911c9dc5; // 32-bit FNV offset basis
-    for (wchar_t wc : str)
+    auto slot = ghost_table.Add(player_id);
+    if (!slot)
     {
-        // since wchar_t is 2 bytes wide, we must put each byte into the hash individually
-        auto b1 = uint8_t(wc >> 8);
-        result ^= b1;
-        result *= 0x01000193; // 32-bit FNV prime
-
-        auto b2 = uint8_t(wc);
-        result ^= b2;
-        result *= 0x01000193; // 32-bit FNV prime
+        Log(L"No free ghost slot for player with id " + std::to_wstring(player_id), LogType::Warning);
+        return;
     }
-    return result;
+    ghosts[*slot] = Ghost{ .id = player_id, .color = color, .name = ToFString(player_name) };
 }
 
-RC::Unreal::FString ToFString(const std::string& input)
+// Logs the playout delay of the ghost in slot if it has moved far enough from the last one logged.
+void ReportDelay(size_t slot)
 {
-    return RC::Unreal::FString(ToWide(input).c_str());
-}
+    const auto& jitter = ghost_table.GetJitter(slot);
+    auto& ghost = ghosts[slot];
+    if (!jitter.Ready() || std::abs(jitter.Delay() - ghost.reported_delay) < REPORT_DELAY_CHANGE)
+    {
+        return;
+    }
 
-// Serializes src into 1 byte of buf starting at pos and increments pos by 1.
-void SerializeU8(uint8_t src, boost::array<uint8_t, SEND>& buf, size_t& pos)
-{
-    buf[pos] = src;
-    pos += 1;
+    ghost.reported_delay = jitter.Delay();
+    Log(L"Playout delay for player with id " + std::to_wstring(ghost.id) + L" is now "
+        + std::to_wstring(std::lround(jitter.Delay())) + L" ms (jitter " + std::to_wstring(std::lround(jitter.Jitter()))
+        + L" ms, loss " + std::to_wstring(std::lround(jitter.Loss() * 100.0f)) + L"%)");
 }
 
-// Serializes src into 4 bytes of buf starting at pos and increments pos by 4.
-void SerializeU32(uint32_t src, boost::array<uint8_t, SEND>& buf, size_t& pos)
+// Logs when ghosts start or stop catching up on the playout delay, and whenever it jumps instead.
+void ReportPlayout()
 {
-    buf[pos + 3] = uint8_t(src);
-    for (int i = 2; i >= 0; i--)
+    auto delay = std::to_wstring(ghost_table.GetPlayoutDelay());
+    auto target = std::to_wstring(ghost_table.GetTargetPlayoutDelay());
+    if (ghost_table.GetPlayoutJumps() != reported_playout_jumps)
     {
-        src >>= 8;
-        buf[pos + i] = uint8_t(src);
+        reported_playout_jumps = ghost_table.GetPlayoutJumps();
+        Log(L"Playout delay jumped to " + target + L" ms (" + std::to_wstring(reported_playout_jumps) + L" total)");
     }
-    pos += 4;
-}
 
-// Serializes src into 4 bytes of buf starting at pos and increments pos by 4.
-void SerializeF32(float src, boost::array<uint8_t, SEND>& buf, size_t& pos)
-{
-    uint32_t src_bits = std::bit_cast<uint32_t>(src);
-    SerializeU32(src_bits, buf, pos);
-}
-
-// Casts src to a float, then serializes that into 4 bytes of buf starting at pos and increments pos by 4.
-void SerializeLocator(double src, boost::array<uint8_t, SEND>& buf, size_t& pos)
-{
-    SerializeF32(float(src), buf, pos);
+    bool catching_up = ghost_table.GetPlayoutRate() != 1.0f;
+    if (catching_up == reported_catching_up)
+    {
+        return;
+    }
+    reported_catching_up = catching_up;
+    if (catching_up)
+    {
+        auto percent = std::lround((ghost_table.GetPlayoutRate() - 1.0f) * 100.0f);
+        Log(L"Playout delay is " + delay + L" ms, catching up on " + target + L" ms at "
+            + (percent < 0 ? L"" : L"+") + std::to_wstring(percent) + L"% speed");
+    }
+    else
+    {
+        Log(L"Playout delay caught up at " + delay + L" ms");
+    }
 }
 
-// Maps src from the range [-180.0, 180.0] to [0, 255], serializes that into 1 byte of buf starting at pos, and
-// increments pos by 1.
-void SerializeRotator(double src, boost::array<uint8_t, SEND>& buf, size_t& pos)
+std::wstring ToWide(const std::string& input)
 {
-    double scaled = (src + 180.0) * 256.0 / 360.0;
-    SerializeU8(uint8_t(scaled), buf, pos);
+    static std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    return converter.from_bytes(input);
 }
 
-// Deserializes 1 byte of buf into a uint8_t starting at pos and increments pos by 1.
-uint8_t DeserializeU8(const boost::array<uint8_t, RECV>& buf, size_t& pos)
+std::string ToUtf8(const std::wstring& input)
 {
-    uint8_t result = buf[pos];
-    pos += 1;
-    return result;
+    static std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    return converter.to_bytes(input);
 }
 
-// Deserializes 4 bytes of buf into a uint32_t starting at pos and increments pos by 4.
-uint32_t DeserializeU32(const boost::array<uint8_t, RECV>& buf, size_t& pos)
+RC::Unreal::FString ToFString(const std::string& input)
 {
-    uint32_t result = buf[pos];
-    for (int i = 1; i < 4; i++)
-    {
-        result <<= 8;
-        result |= buf[pos + i];
-    }
-    pos += 4;
-    return result;
+    return RC::Unreal::FString(ToWide(input).c_str());
 }
 
-// Deserializes 4 bytes of buf into a float starting at pos and increments pos by 4.
-float DeserializeF32(const boost::array<uint8_t, RECV>& buf, size_t& pos)
+// Calculates milliseconds since the connection was opened.
+double LocalMillis(const steady_time_point& now)
 {
-    uint32_t bits = DeserializeU32(buf, pos);
-    return std::bit_cast<float>(bits);
+    return std::chrono::duration<double, std::milli>(now - clock_start).count();
 }
 
-// Deserializes 4 bytes of buf into a float starting at pos and increments pos by 4, then casts the float to a double.
-double DeserializeLocator(const boost::array<uint8_t, RECV>& buf, size_t& pos)
+// Converts now to the server's millisecond counter. This function should only be called if server_clock is ready.
+double ServerMillis(const steady_time_point& now)
 {
-    return double(DeserializeF32(buf, pos));
+    return server_clock.ServerMillis(LocalMillis(now));
 }
 
-// Deserializes 1 byte of buf starting at pos and increments pos by 1, then maps that byte to the range [-180.0, 180.0].
-double DeserializeRotator(const boost::array<uint8_t, RECV>& buf, size_t& pos)
+// Converts millis on the server's timeline to the whole millis states are stamped with, wrapping like the server's
+// counter does.
+uint32_t ToStamp(double millis)
 {
-    uint8_t byte = DeserializeU8(buf, pos);
-    return double(byte) * 360.0 / 256.0 - 180.0;
+    return uint32_t(int64_t(std::floor(millis)));
 }
 
-// Calculates milliseconds since the first update. This function should only be called if timers has a value.
-uint32_t MillisSinceStart(const steady_time_point& now)
+// Gets the current time from time_source.
+steady_time_point Now()
 {
-    return uint32_t((now - timers->first).count() / 1000000ll);
+    return time_source();
 }
 
 // Increments nanos based on the amount of time that has passed since the last time this function was called. This
-// function should only be called if timers has a value. Returns now.
+// function should only be called if update_timer has a value. Returns now.
 steady_time_point AdvanceNanos()
 {
-    auto now = std::chrono::steady_clock::now();
-    nanos += (now - timers->second).count();
-    timers->second = now;
+    auto now = Now();
+    nanos += (now - *update_timer).count();
+    update_timer = now;
     return now;
 }
 
+// Bumps epoch if info is too far from the location in the last frame to have gotten there without teleporting.
+void DetectTeleport(const FST_PlayerInfo& info)
+{
+    std::array<double, 3> location = { info.location_x, info.location_y, info.location_z };
+    if (last_location)
+    {
+        double x = location[0] - (*last_location)[0];
+        double y = location[1] - (*last_location)[1];
+        double z = location[2] - (*last_location)[2];
+        if (x * x + y * y + z * z > TELEPORT_DISTANCE * TELEPORT_DISTANCE)
+        {
+            epoch++;
+        }
+    }
+    last_location = location;
+}
+
 // Sends an update if enough nanos have been accrued. Returns whether an update was sent.
 bool TrySendUpdate(const FST_PlayerInfo& info, const uint32_t& millis)
 {
+    if (!current_zone_index)
+    {
+        return false;
+    }
     if (nanos / NANOS_PER_UPDATE)
     {
         nanos = nanos % NANOS_PER_UPDATE;
@@ -677,21 +566,20 @@ bool TrySendUpdate(const FST_PlayerInfo& info, const uint32_t& millis)
     return false;
 }
 
-// Sends an update.
+// Hands an update to the network thread, which encodes and sends it.
 void SendUpdate(const FST_PlayerInfo& info, const uint32_t& millis)
 {
-    boost::array<uint8_t, SEND> buf{};
-    size_t pos = 0;
-    SerializeU8(*id, buf, pos);
-    SerializeU32(millis, buf, pos);
-    SerializeU32(current_zone, buf, pos);
-    SerializeLocator(info.location_x, buf, pos);
-    SerializeLocator(info.location_y, buf, pos);
-    SerializeLocator(info.location_z, buf, pos);
-    SerializeRotator(info.rotation_x, buf, pos);
-    SerializeRotator(info.rotation_y, buf, pos);
-    SerializeRotator(info.rotation_z, buf, pos);
-    udp->Send(buf);
+    NetThread::Command command{
+        .kind = NetThread::Command::Kind::Update,
+        .millis = millis,
+        .epoch = epoch,
+        .location = { info.location_x, info.location_y, info.location_z },
+        .rotation = { info.rotation_x, info.rotation_y, info.rotation_z },
+    };
+    if (!NetThread::Push(command))
+    {
+        Log(L"Dropped an update because the network thread isn't keeping up", LogType::Warning);
+    }
 }
 
 } // namespace
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "ClockSync.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    using ClockSync::MAX_ESTIMATES;
+    using ClockSync::MAX_SAMPLES;
+
+    // pongs that took longer than this to come back are too stale to say anything about the offset
+    const uint32_t MAX_RTT = 5000;
+    // an exchange is accepted if its round trip was at most this much slower than the fastest recent one, both as a
+    // fraction of the fastest and in milliseconds so fast links aren't held to sub-millisecond precision
+    const float RTT_SLACK = 0.5f;
+    const uint32_t MIN_RTT_SLACK = 2;
+    // drift is only fitted once the accepted exchanges span this many milliseconds; over a shorter span, noise in the
+    // offsets swamps it
+    const uint32_t MIN_DRIFT_SPAN = 30000;
+    // real clocks drift by tens of parts per million, so anything past this is noise
+    const double MAX_DRIFT = 500e-6;
+
+    int32_t Difference(uint32_t, uint32_t);
+}
+
+void ClockSync::ClockSync::Clear()
+{
+    *this = ClockSync();
+}
+
+void ClockSync::ClockSync::OnPong(uint32_t sent, uint32_t server_millis, uint32_t received)
+{
+    int32_t rtt = Difference(received, sent);
+    if (rtt < 0 || uint32_t(rtt) > MAX_RTT)
+    {
+        return;
+    }
+
+    // assume the ping and pong took equally long, so the server stamped it halfway through the round trip
+    uint32_t millis = sent + uint32_t(rtt) / 2;
+    Sample sample{ .millis = millis, .offset = Difference(server_millis, millis), .rtt = uint32_t(rtt) };
+    if (_samples_count == MAX_SAMPLES)
+    {
+        _samples[_samples_head] = sample;
+        _samples_head = (_samples_head + 1) % MAX_SAMPLES;
+    }
+    else
+    {
+        _samples[(_samples_head + _samples_count) % MAX_SAMPLES] = sample;
+        _samples_count++;
+    }
+
+    uint32_t min_rtt = Rtt();
+    uint32_t slack = std::max(MIN_RTT_SLACK, uint32_t(float(min_rtt) * RTT_SLACK));
+    if (sample.rtt > min_rtt + slack)
+    {
+        return;
+    }
+
+    if (_estimates_count == MAX_ESTIMATES)
+    {
+        _estimates[_estimates_head] = sample;
+        _estimates_head = (_estimates_head + 1) % MAX_ESTIMATES;
+    }
+    else
+    {
+        _estimates[(_estimates_head + _estimates_count) % MAX_ESTIMATES] = sample;
+        _estimates_count++;
+    }
+    Fit();
+}
+
+bool ClockSync::ClockSync::Ready() const
+{
+    return _estimates_count > 0;
+}
+
+double ClockSync::ClockSync::ServerMillis(double millis)
+{
+    double server_millis = millis + _offset + _drift * (millis - double(_reference_millis));
+    if (_has_server_millis && server_millis < _last_server_millis)
+    {
+        return _last_server_millis;
+    }
+    _last_server_millis = server_millis;
+    _has_server_millis = true;
+    return server_millis;
+}
+
+uint32_t ClockSync::ClockSync::Rtt() const
+{
+    uint32_t min_rtt = MAX_RTT;
+    for (size_t i = 0; i < _samples_count; i++)
+    {
+        min_rtt = std::min(min_rtt, _samples[i].rtt);
+    }
+    return min_rtt;
+}
+
+float ClockSync::ClockSync::Drift() const
+{
+    return float(_drift * 1e6);
+}
+
+// Fits a line through the offsets of the accepted exchanges with least squares, measured from the newest one.
+void ClockSync::ClockSync::Fit()
+{
+    const auto& newest = _estimates[(_estimates_head + _estimates_count - 1) % MAX_ESTIMATES];
+    _reference_millis = newest.millis;
+
+    double mean_x = 0.0;
+    double mean_y = 0.0;
+    int32_t oldest_x = 0;
+    for (size_t i = 0; i < _estimates_count; i++)
+    {
+        int32_t x = Difference(_estimates[i].millis, _reference_millis);
+        oldest_x = std::min(oldest_x, x);
+        mean_x += double(x);
+        mean_y += double(_estimates[i].offset);
+    }
+    mean_x /= double(_estimates_count);
+    mean_y /= double(_estimates_count);
+
+    _drift = 0.0;
+    if (uint32_t(-oldest_x) >= MIN_DRIFT_SPAN)
+    {
+        double covariance = 0.0;
+        double variance = 0.0;
+        for (size_t i = 0; i < _estimates_count; i++)
+        {
+            double dx = double(Difference(_estimates[i].millis, _reference_millis)) - mean_x;
+            covariance += dx * (double(_estimates[i].offset) - mean_y);
+            variance += dx * dx;
+        }
+        _drift = std::clamp(covariance / variance, -MAX_DRIFT, MAX_DRIFT);
+    }
+    _offset = mean_y - _drift * mean_x;
+}
+
+namespace
+{
+
+// Returns how far a is after b, accounting for wrapping.
+int32_t Difference(uint32_t a, uint32_t b)
+{
+    return int32_t(a - b);
+}
+
+} // namespace
@@ -0,0 +1,657 @@
+#pragma once
+
+#include "GhostTable.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+
+#include "Simd.hpp"
+
+namespace
+{
+    using GhostTable::MAX_GHOSTS;
+    using GhostTable::MAX_STATES;
+    using Interpolator::COMPONENTS;
+    using Interpolator::LOCATION_COMPONENTS;
+
+    const uint32_t EMPTY_MILLIS = std::numeric_limits<uint32_t>::max();
+
+    // when real data replaces a guess from dead reckoning, the difference is blended out with this time constant
+    // instead of snapping
+    const float CORRECTION_MILLIS = 100.0f;
+    // differences bigger than this (in cm) are snapped anyway, since blending them would look like a slide
+    const float MAX_CORRECTION = 300.0f;
+
+    // when the playout delay is off from its target, ghosts play a little faster or slower until it isn't, like
+    // time-stretched audio. the rate changes by PLAYOUT_GAIN for every milli off, up to MAX_RATE_CHANGE either way.
+    // catching up starts once the delay is CATCH_UP_START off and keeps going until it's within CATCH_UP_STOP, so
+    // small wobbles in the target don't keep nudging the rate
+    const double PLAYOUT_GAIN = 0.001;
+    const double MAX_RATE_CHANGE = 0.05;
+    const double CATCH_UP_START = 5.0;
+    const double CATCH_UP_STOP = 0.5;
+    // it would take too long to catch up on anything further off than this, so it's jumped instead
+    const double MAX_CATCH_UP = 500.0;
+    // at most this much time counts towards catching up in one frame, so a hitch doesn't turn into a jump
+    const double MAX_CATCH_UP_STEP = 100.0;
+
+    size_t CountAtOrBefore(const uint32_t*, uint32_t);
+    float WrapAngle(float);
+}
+
+GhostTable::GhostTable::GhostTable() : _interpolator(Interpolator::Create(Interpolator::Kind::Hermite))
+{
+    Clear();
+}
+
+void GhostTable::GhostTable::SetInterpolator(std::unique_ptr<Interpolator::Interpolator> interpolator)
+{
+    _interpolator = std::move(interpolator);
+}
+
+void GhostTable::GhostTable::SetMaxExtrapolation(uint32_t millis)
+{
+    _max_extrapolation = millis;
+}
+
+std::optional<size_t> GhostTable::GhostTable::Add(uint8_t id)
+{
+    if (_slot_of_id[id] != NO_SLOT)
+    {
+        ClearSlot(_slot_of_id[id]);
+        return _slot_of_id[id];
+    }
+
+    uint32_t free_slots = ~_active_slots;
+    if constexpr (MAX_GHOSTS < 32)
+    {
+        free_slots &= (1u << MAX_GHOSTS) - 1;
+    }
+    if (free_slots == 0)
+    {
+        return {};
+    }
+
+    size_t slot = size_t(std::countr_zero(free_slots));
+    ClearSlot(slot);
+    _active_slots |= 1u << slot;
+    _slot_of_id[id] = uint8_t(slot);
+    _id_of_slot[slot] = id;
+    return slot;
+}
+
+void GhostTable::GhostTable::Remove(uint8_t id)
+{
+    if (_slot_of_id[id] == NO_SLOT)
+    {
+        return;
+    }
+
+    size_t slot = _slot_of_id[id];
+    ClearSlot(slot);
+    _active_slots &= ~(1u << slot);
+    _slot_of_id[id] = NO_SLOT;
+}
+
+void GhostTable::GhostTable::Clear()
+{
+    for (size_t slot = 0; slot < MAX_GHOSTS; slot++)
+    {
+        ClearSlot(slot);
+    }
+    _slot_of_id.fill(NO_SLOT);
+    _id_of_slot.fill(0);
+    _active_slots = 0;
+    _last_update_millis.reset();
+    _playout_delay = _target_playout_delay = 0.0;
+    _playout_rate = 1.0;
+    _playout_jumps = 0;
+    _playout_ready = false;
+    _catching_up = false;
+}
+
+std::optional<size_t> GhostTable::GhostTable::SlotOf(uint8_t id) const
+{
+    if (_slot_of_id[id] == NO_SLOT)
+    {
+        return {};
+    }
+    return _slot_of_id[id];
+}
+
+uint8_t GhostTable::GhostTable::IdOf(size_t slot) const
+{
+    return _id_of_slot[slot];
+}
+
+uint32_t GhostTable::GhostTable::ActiveSlots() const
+{
+    return _active_slots;
+}
+
+bool GhostTable::GhostTable::CanInsert(size_t slot, uint32_t ghost_millis) const
+{
+    // EMPTY_MILLIS marks unused entries, so a state can't use it
+    if (ghost_millis == EMPTY_MILLIS)
+    {
+        return false;
+    }
+
+    size_t i = LowerBound(slot, ghost_millis);
+    if (i < _count[slot] && _millis[Index(slot, i)] == ghost_millis)
+    {
+        return false;
+    }
+    // if states is full, the new state must not be the oldest, otherwise it would be dropped right away
+    return _count[slot] < MAX_STATES || i > 0;
+}
+
+void GhostTable::GhostTable::Insert(size_t slot, const State& state, uint32_t millis)
+{
+    size_t count = _count[slot];
+
+    bool newest = count == 0 || state.millis > _millis[Index(slot, count - 1)];
+    _jitter[slot].OnArrival(state.millis, millis, newest);
+
+    size_t i = LowerBound(slot, state.millis);
+    if (count == MAX_STATES)
+    {
+        // drop the oldest state to make room; CanInsert guarantees i > 0 here
+        _millis[Index(slot, 0)] = EMPTY_MILLIS;
+        _head[slot] = uint8_t((_head[slot] + 1) & (MAX_STATES - 1));
+        count--;
+        i--;
+    }
+
+    // shift everything from i onwards back one to keep states sorted. states almost always arrive in order, in which
+    // case i == count and nothing moves
+    for (size_t j = count; j > i; j--)
+    {
+        CopyState(Index(slot, j - 1), Index(slot, j));
+    }
+
+    size_t index = Index(slot, i);
+    _millis[index] = state.millis;
+    _zone[index] = state.zone;
+    _epoch[index] = state.epoch;
+    _location_x[index] = state.location[0];
+    _location_y[index] = state.location[1];
+    _location_z[index] = state.location[2];
+    _rotation_x[index] = state.rotation[0];
+    _rotation_y[index] = state.rotation[1];
+    _rotation_z[index] = state.rotation[2];
+    _count[slot] = uint8_t(count + 1);
+}
+
+void GhostTable::GhostTable::Update(double millis)
+{
+    // remember how each ghost was posed last frame so guesses from dead reckoning can be blended out
+    uint32_t previously_posed = _posed_slots;
+    uint32_t previously_extrapolating = _extrapolating_slots;
+    auto previous_zone = _pose_zone;
+    auto previous_epoch = _pose_epoch;
+    auto previous_extrapolated_from = _extrapolated_from;
+    auto previous_velocity = _velocity;
+    auto previous_extrapolation = _extrapolation;
+
+    double elapsed = _last_update_millis ? std::max(0.0, millis - *_last_update_millis) : 0.0;
+    _last_update_millis = millis;
+
+    // every ghost is played back at the same instant on the shared timeline, far enough behind that the ghost whose
+    // states take longest to arrive still has time to get them
+    bool any_ready = false;
+    int64_t target = 0;
+    for (uint32_t slots = _active_slots; slots != 0; slots &= slots - 1)
+    {
+        const auto& jitter = _jitter[size_t(std::countr_zero(slots))];
+        if (jitter.Ready())
+        {
+            any_ready = true;
+            target = std::max(target, int64_t(std::lround(jitter.Delay())) - jitter.Offset());
+        }
+    }
+    AdvancePlayout(double(target), any_ready, elapsed);
+
+    // split the target into the whole millis that states are stamped with, which wrap, and how far past that it is
+    double target_millis = std::floor(millis - _playout_delay);
+    auto ghost_millis = uint32_t(int64_t(target_millis));
+    auto fraction = float(millis - _playout_delay - target_millis);
+    // keep the target below EMPTY_MILLIS so unused entries never count as being at or before it
+    if (ghost_millis >= EMPTY_MILLIS)
+    {
+        ghost_millis = EMPTY_MILLIS - 1;
+        fraction = 0.0f;
+    }
+
+    // bracketing pass: find the states on either side of the target millis for each ghost and stage them for the
+    // interpolator. slots without a pose are staged as zeros so the interpolator can run over every slot
+    // unconditionally
+    _posed_slots = 0;
+    _extrapolating_slots = 0;
+    for (size_t slot = 0; slot < MAX_GHOSTS; slot++)
+    {
+        size_t count = _count[slot];
+        _extrapolation[slot] = 0.0f;
+        if (!(_active_slots & (1u << slot)) || count == 0 || !_jitter[slot].Ready())
+        {
+            _pct[slot] = 0.0f;
+            _lower_weight[slot] = 0.0f;
+            _upper_weight[slot] = 0.0f;
+            for (size_t c = 0; c < COMPONENTS; c++)
+            {
+                size_t i = c * MAX_GHOSTS + slot;
+                _before[i] = _lower[i] = _upper[i] = _after[i] = 0.0f;
+                _velocity[i] = _correction[i] = 0.0f;
+            }
+            continue;
+        }
+
+        // the number of states at or before ghost_millis is the sorted index of the upper state, regardless of
+        // where the ring wraps
+        size_t upper = CountAtOrBefore(&_millis[slot * MAX_STATES], ghost_millis);
+        size_t lower;
+        float pct;
+        if (upper == 0)
+        {
+            // before the buffered range, so clamp to the oldest state
+            lower = upper = 0;
+            pct = 0.0f;
+        }
+        else if (upper == count)
+        {
+            // past the newest state, so hold it and keep it moving with dead reckoning
+            lower = upper = count - 1;
+            pct = 0.0f;
+            StageExtrapolation(slot, float(ghost_millis - _millis[Index(slot, count - 1)]) + fraction);
+        }
+        else
+        {
+            lower = upper - 1;
+            size_t lower_index = Index(slot, lower);
+            size_t upper_index = Index(slot, upper);
+            // distance from lower as a percentage. upper is after ghost_millis, so upper_dist is always positive
+            float lower_dist = float(ghost_millis - _millis[lower_index]) + fraction;
+            float upper_dist = float(_millis[upper_index] - ghost_millis) - fraction;
+            pct = lower_dist / (lower_dist + upper_dist);
+            if (!Continuous(lower_index, upper_index))
+            {
+                // if the two closest states differ by zone or the ghost teleported between them, just use the closer
+                // one
+                pct = pct < 0.5f ? 0.0f : 1.0f;
+            }
+        }
+
+        Stage(slot, lower, upper);
+        _pct[slot] = pct;
+        _pose_millis[slot] = ghost_millis;
+        size_t pose_index = Index(slot, pct < 0.5f ? lower : upper);
+        _pose_zone[slot] = _zone[pose_index];
+        _pose_epoch[slot] = _epoch[pose_index];
+        _posed_slots |= 1u << slot;
+    }
+
+    Interpolator::Batch batch
+    {
+        .size = MAX_GHOSTS,
+        .before = _before.data(),
+        .lower = _lower.data(),
+        .upper = _upper.data(),
+        .after = _after.data(),
+        .pct = _pct.data(),
+        .lower_weight = _lower_weight.data(),
+        .upper_weight = _upper_weight.data(),
+    };
+    _interpolator->Interpolate(batch, _raw.data());
+
+    // whenever a ghost was guessed by dead reckoning last frame and its guess is now based on different data, carry
+    // the difference between where last frame's guess would be now and the new pose as a correction so the ghost
+    // doesn't snap
+    for (uint32_t slots = _posed_slots & previously_posed & previously_extrapolating; slots != 0; slots &= slots - 1)
+    {
+        size_t slot = size_t(std::countr_zero(slots));
+        bool rebased = !(_extrapolating_slots & (1u << slot))
+            || _extrapolated_from[slot] != previous_extrapolated_from[slot];
+        if (rebased && _pose_zone[slot] == previous_zone[slot] && _pose_epoch[slot] == previous_epoch[slot])
+        {
+            // last frame's guess would have kept moving for the elapsed millis, until it hit the cap
+            float extrapolation = previous_extrapolation[slot];
+            float advance = std::min(extrapolation + float(elapsed), float(_max_extrapolation)) - extrapolation;
+            Correct(slot, previous_velocity, std::max(advance, 0.0f));
+        }
+    }
+    // ghosts that just showed up, changed zones or teleported start fresh
+    for (uint32_t slots = _posed_slots; slots != 0; slots &= slots - 1)
+    {
+        size_t slot = size_t(std::countr_zero(slots));
+        if (!(previously_posed & (1u << slot)) || _pose_zone[slot] != previous_zone[slot]
+            || _pose_epoch[slot] != previous_epoch[slot])
+        {
+            for (size_t c = 0; c < COMPONENTS; c++)
+            {
+                _correction[c * MAX_GHOSTS + slot] = 0.0f;
+            }
+        }
+    }
+
+    ApplyMotion(std::exp(-float(elapsed) / CORRECTION_MILLIS));
+}
+
+bool GhostTable::GhostTable::HasPose(size_t slot) const
+{
+    return _posed_slots & (1u << slot);
+}
+
+uint32_t GhostTable::GhostTable::GetPlayoutDelay() const
+{
+    return uint32_t(std::lround(_playout_delay));
+}
+
+uint32_t GhostTable::GhostTable::GetTargetPlayoutDelay() const
+{
+    return uint32_t(std::lround(_target_playout_delay));
+}
+
+float GhostTable::GhostTable::GetPlayoutRate() const
+{
+    return float(_playout_rate);
+}
+
+uint32_t GhostTable::GhostTable::GetPlayoutJumps() const
+{
+    return _playout_jumps;
+}
+
+const JitterEstimator::JitterEstimator& GhostTable::GhostTable::GetJitter(size_t slot) const
+{
+    return _jitter[slot];
+}
+
+GhostTable::State GhostTable::GhostTable::GetPose(size_t slot) const
+{
+    return State
+    {
+        .millis = _pose_millis[slot],
+        .zone = _pose_zone[slot],
+        .epoch = _pose_epoch[slot],
+        .location = { _pose[0 * MAX_GHOSTS + slot], _pose[1 * MAX_GHOSTS + slot], _pose[2 * MAX_GHOSTS + slot] },
+        .rotation = { _pose[3 * MAX_GHOSTS + slot], _pose[4 * MAX_GHOSTS + slot], _pose[5 * MAX_GHOSTS + slot] },
+    };
+}
+
+// Moves the playout delay towards target by playing slightly faster or slower than real time for the elapsed millis.
+// The delay jumps straight to target when ghosts first become ready, or when it's too far off to catch up on.
+void GhostTable::GhostTable::AdvancePlayout(double target, bool any_ready, double elapsed)
+{
+    _target_playout_delay = target;
+    double error = _playout_delay - target;
+    if (!any_ready || !_playout_ready || std::abs(error) > MAX_CATCH_UP)
+    {
+        if (any_ready && _playout_ready)
+        {
+            _playout_jumps++;
+        }
+        _playout_delay = target;
+        _playout_rate = 1.0;
+        _playout_ready = any_ready;
+        _catching_up = false;
+        return;
+    }
+
+    if (std::abs(error) > CATCH_UP_START)
+    {
+        _catching_up = true;
+    }
+    else if (std::abs(error) < CATCH_UP_STOP)
+    {
+        _catching_up = false;
+    }
+
+    // a delay that's too big means ghosts are further behind than they need to be, so they play faster
+    _playout_rate = 1.0;
+    if (_catching_up)
+    {
+        _playout_rate += std::clamp(error * PLAYOUT_GAIN, -MAX_RATE_CHANGE, MAX_RATE_CHANGE);
+    }
+    double step = std::min(elapsed, MAX_CATCH_UP_STEP) * (_playout_rate - 1.0);
+    // don't overshoot the target on a long frame
+    _playout_delay -= error > 0.0 ? std::min(step, error) : std::max(step, error);
+}
+
+// Returns whether the states at index a and index b are on one unbroken path, i.e. neither a zone change nor a teleport
+// happened between them.
+bool GhostTable::GhostTable::Continuous(size_t a, size_t b) const
+{
+    return _zone[a] == _zone[b] && _epoch[a] == _epoch[b];
+}
+
+// Returns the index into the per-state arrays of the ith oldest state of slot.
+size_t GhostTable::GhostTable::Index(size_t slot, size_t i) const
+{
+    return slot * MAX_STATES + ((_head[slot] + i) & (MAX_STATES - 1));
+}
+
+// Returns the sorted index of the first state of slot with millis >= ghost_millis, or the slot's count if there isn't
+// one.
+size_t GhostTable::GhostTable::LowerBound(size_t slot, uint32_t ghost_millis) const
+{
+    size_t lo = 0;
+    size_t hi = _count[slot];
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (_millis[Index(slot, mid)] < ghost_millis)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void GhostTable::GhostTable::ClearSlot(size_t slot)
+{
+    for (size_t i = 0; i < MAX_STATES; i++)
+    {
+        _millis[slot * MAX_STATES + i] = EMPTY_MILLIS;
+    }
+    _head[slot] = 0;
+    _count[slot] = 0;
+    _jitter[slot].Clear();
+    _posed_slots &= ~(1u << slot);
+    _extrapolating_slots &= ~(1u << slot);
+    for (size_t c = 0; c < COMPONENTS; c++)
+    {
+        _velocity[c * MAX_GHOSTS + slot] = 0.0f;
+        _correction[c * MAX_GHOSTS + slot] = 0.0f;
+    }
+}
+
+// Stages the states with sorted indices lower and upper of slot, along with their neighbours, for the interpolator.
+// Neighbours that are missing or not continuous with the pair are replaced by stand-ins mirrored across the pair, which
+// keeps the curve straight at that end. lower and upper can be the same state, in which case the pose is that state.
+void GhostTable::GhostTable::Stage(size_t slot, size_t lower, size_t upper)
+{
+    const std::array<const float*, COMPONENTS> components = {
+        _location_x.data(), _location_y.data(), _location_z.data(),
+        _rotation_x.data(), _rotation_y.data(), _rotation_z.data(),
+    };
+
+    size_t lower_index = Index(slot, lower);
+    size_t upper_index = Index(slot, upper);
+    bool has_before = lower > 0 && Continuous(Index(slot, lower - 1), lower_index);
+    bool has_after = upper + 1 < _count[slot] && Continuous(Index(slot, upper + 1), upper_index);
+    size_t before_index = has_before ? Index(slot, lower - 1) : lower_index;
+    size_t after_index = has_after ? Index(slot, upper + 1) : upper_index;
+
+    float span = float(_millis[upper_index] - _millis[lower_index]);
+    float before_span = has_before ? float(_millis[upper_index] - _millis[before_index]) : 2.0f * span;
+    float after_span = has_after ? float(_millis[after_index] - _millis[lower_index]) : 2.0f * span;
+    _lower_weight[slot] = span > 0.0f ? span / before_span : 0.0f;
+    _upper_weight[slot] = span > 0.0f ? span / after_span : 0.0f;
+
+    for (size_t c = 0; c < COMPONENTS; c++)
+    {
+        const float* component = components[c];
+        float lower_value = component[lower_index];
+        float upper_value = component[upper_index];
+        float before_value = component[before_index];
+        float after_value = component[after_index];
+        if (c >= LOCATION_COMPONENTS)
+        {
+            // unwrap each rotation relative to the one before it so every difference takes the shortest arc
+            upper_value = lower_value + WrapAngle(upper_value - lower_value);
+            before_value = lower_value - WrapAngle(lower_value - before_value);
+            after_value = upper_value + WrapAngle(after_value - upper_value);
+        }
+
+        size_t i = c * MAX_GHOSTS + slot;
+        _lower[i] = lower_value;
+        _upper[i] = upper_value;
+        _before[i] = has_before ? before_value : 2.0f * lower_value - upper_value;
+        _after[i] = has_after ? after_value : 2.0f * upper_value - lower_value;
+    }
+}
+
+// Stages dead reckoning for a slot whose target time is past_newest millis past its newest state: the ghost keeps
+// moving at the velocity between its two newest states, for at most _max_extrapolation millis.
+void GhostTable::GhostTable::StageExtrapolation(size_t slot, float past_newest)
+{
+    size_t count = _count[slot];
+    size_t newest_index = Index(slot, count - 1);
+    _extrapolating_slots |= 1u << slot;
+    _extrapolated_from[slot] = _millis[newest_index];
+
+    const std::array<const float*, COMPONENTS> components = {
+        _location_x.data(), _location_y.data(), _location_z.data(),
+        _rotation_x.data(), _rotation_y.data(), _rotation_z.data(),
+    };
+
+    size_t previous_index = count > 1 ? Index(slot, count - 2) : newest_index;
+    bool has_velocity = count > 1 && Continuous(previous_index, newest_index);
+    float span = float(_millis[newest_index] - _millis[previous_index]);
+    for (size_t c = 0; c < COMPONENTS; c++)
+    {
+        float difference = components[c][newest_index] - components[c][previous_index];
+        if (c >= LOCATION_COMPONENTS)
+        {
+            difference = WrapAngle(difference);
+        }
+        _velocity[c * MAX_GHOSTS + slot] = has_velocity ? difference / span : 0.0f;
+    }
+
+    _extrapolation[slot] = has_velocity ? std::min(past_newest, float(_max_extrapolation)) : 0.0f;
+}
+
+// Sets the correction of a slot so that, with its new raw pose and dead reckoning, it ends up exactly where last
+// frame's pose would be after moving at previous_velocity for advance millis. Differences too big to blend out are
+// dropped, so the ghost snaps instead.
+void GhostTable::GhostTable::Correct(
+    size_t slot,
+    const std::array<float, MAX_GHOSTS * COMPONENTS>& previous_velocity,
+    float advance
+) {
+    std::array<float, COMPONENTS> difference;
+    float distance_squared = 0.0f;
+    for (size_t c = 0; c < COMPONENTS; c++)
+    {
+        size_t i = c * MAX_GHOSTS + slot;
+        difference[c] = (_pose[i] + previous_velocity[i] * advance) - (_raw[i] + _velocity[i] * _extrapolation[slot]);
+        if (c >= LOCATION_COMPONENTS)
+        {
+            difference[c] = WrapAngle(difference[c]);
+        }
+        else
+        {
+            distance_squared += difference[c] * difference[c];
+        }
+    }
+
+    bool snap = distance_squared > MAX_CORRECTION * MAX_CORRECTION;
+    for (size_t c = 0; c < COMPONENTS; c++)
+    {
+        _correction[c * MAX_GHOSTS + slot] = snap ? 0.0f : difference[c];
+    }
+}
+
+// Writes the final poses: the raw interpolated poses moved along by dead reckoning and offset by any corrections,
+// which then decay by decay for the next frame.
+void GhostTable::GhostTable::ApplyMotion(float decay)
+{
+    const Simd::Vec decay_vec = Simd::Set(decay);
+    for (size_t slot = 0; slot < MAX_GHOSTS; slot += Simd::WIDTH)
+    {
+        Simd::Vec extrapolation = Simd::Load(_extrapolation.data() + slot);
+        for (size_t c = 0; c < COMPONENTS; c++)
+        {
+            size_t i = c * MAX_GHOSTS + slot;
+            Simd::Vec correction = Simd::Load(_correction.data() + i);
+            Simd::Vec motion = Simd::Mul(Simd::Load(_velocity.data() + i), extrapolation);
+            Simd::Vec result = Simd::Add(Simd::Load(_raw.data() + i), Simd::Add(motion, correction));
+            Simd::Store(_pose.data() + i, c < LOCATION_COMPONENTS ? result : Simd::WrapAngle(result));
+            Simd::Store(_correction.data() + i, Simd::Mul(correction, decay_vec));
+        }
+    }
+}
+
+void GhostTable::GhostTable::CopyState(size_t from, size_t to)
+{
+    _millis[to] = _millis[from];
+    _zone[to] = _zone[from];
+    _epoch[to] = _epoch[from];
+    _location_x[to] = _location_x[from];
+    _location_y[to] = _location_y[from];
+    _location_z[to] = _location_z[from];
+    _rotation_x[to] = _rotation_x[from];
+    _rotation_y[to] = _rotation_y[from];
+    _rotation_z[to] = _rotation_z[from];
+}
+
+namespace
+{
+
+// Counts the entries of a row of MAX_STATES millis that are <= ghost_millis. Unused entries are EMPTY_MILLIS, so they
+// are never counted as long as ghost_millis < EMPTY_MILLIS.
+size_t CountAtOrBefore(const uint32_t* row, uint32_t ghost_millis)
+{
+    size_t after = 0;
+#if defined(SIMD_AVX2)
+    // there's no unsigned compare, so flip the sign bit of both sides and compare signed instead
+    const __m256i bias = _mm256_set1_epi32(std::numeric_limits<int32_t>::min());
+    const __m256i target = _mm256_xor_si256(_mm256_set1_epi32(int32_t(ghost_millis)), bias);
+    for (size_t i = 0; i < MAX_STATES; i += 8)
+    {
+        __m256i millis = _mm256_xor_si256(_mm256_load_si256(reinterpret_cast<const __m256i*>(row + i)), bias);
+        __m256i gt = _mm256_cmpgt_epi32(millis, target);
+        after += std::popcount(uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(gt))));
+    }
+#elif defined(SIMD_SSE2)
+    // there's no unsigned compare, so flip the sign bit of both sides and compare signed instead
+    const __m128i bias = _mm_set1_epi32(std::numeric_limits<int32_t>::min());
+    const __m128i target = _mm_xor_si128(_mm_set1_epi32(int32_t(ghost_millis)), bias);
+    for (size_t i = 0; i < MAX_STATES; i += 4)
+    {
+        __m128i millis = _mm_xor_si128(_mm_load_si128(reinterpret_cast<const __m128i*>(row + i)), bias);
+        __m128i gt = _mm_cmpgt_epi32(millis, target);
+        after += std::popcount(uint32_t(_mm_movemask_ps(_mm_castsi128_ps(gt))));
+    }
+#else
+    for (size_t i = 0; i < MAX_STATES; i++)
+    {
+        after += row[i] > ghost_millis;
+    }
+#endif
+    return MAX_STATES - after;
+}
+
+// Wraps an angle in degrees to [-180.0, 180.0].
+float WrapAngle(float angle)
+{
+    return std::remainder(angle, 360.0f);
+}
+
+} // namespace
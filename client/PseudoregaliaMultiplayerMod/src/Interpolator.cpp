@@ -0,0 +1,110 @@
+#pragma once
+
+#include "Interpolator.hpp"
+
+#include "Simd.hpp"
+
+namespace
+{
+    using Interpolator::Batch;
+    using Interpolator::COMPONENTS;
+    using Interpolator::LOCATION_COMPONENTS;
+    using namespace Simd;
+
+    class Linear : public Interpolator::Interpolator
+    {
+    public:
+        void Interpolate(const Batch& batch, float* pose) const override;
+    };
+
+    class Hermite : public Interpolator::Interpolator
+    {
+    public:
+        void Interpolate(const Batch& batch, float* pose) const override;
+    };
+}
+
+std::optional<Interpolator::Kind> Interpolator::ParseKind(const std::string& name)
+{
+    if (name == "linear")
+    {
+        return Kind::Linear;
+    }
+    if (name == "hermite")
+    {
+        return Kind::Hermite;
+    }
+    return {};
+}
+
+std::unique_ptr<Interpolator::Interpolator> Interpolator::Create(Kind kind)
+{
+    switch (kind)
+    {
+    case Kind::Linear:
+        return std::make_unique<Linear>();
+    case Kind::Hermite:
+    default:
+        return std::make_unique<Hermite>();
+    }
+}
+
+namespace
+{
+
+// Interpolates location along a straight line from lower to upper, and rotation along the shortest arc.
+void Linear::Interpolate(const Batch& batch, float* pose) const
+{
+    for (size_t i = 0; i < batch.size; i += WIDTH)
+    {
+        Vec pct = Load(batch.pct + i);
+        for (size_t c = 0; c < COMPONENTS; c++)
+        {
+            size_t offset = c * batch.size + i;
+            Vec lower = Load(batch.lower + offset);
+            Vec upper = Load(batch.upper + offset);
+            Vec result = Add(lower, Mul(Sub(upper, lower), pct));
+            Store(pose + offset, c < LOCATION_COMPONENTS ? result : WrapAngle(result));
+        }
+    }
+}
+
+// Interpolates along a cubic Hermite curve from lower to upper. The tangent at each end is the slope between that
+// end's neighbours, like a Catmull-Rom spline, scaled by the batch weights so uneven gaps between states don't bend
+// the curve. Rotations are unwrapped by the caller, so the curve follows the shortest arc.
+void Hermite::Interpolate(const Batch& batch, float* pose) const
+{
+    const Vec one = Set(1.0f);
+    const Vec two = Set(2.0f);
+    const Vec three = Set(3.0f);
+    for (size_t i = 0; i < batch.size; i += WIDTH)
+    {
+        Vec s = Load(batch.pct + i);
+        Vec s2 = Mul(s, s);
+        Vec s3 = Mul(s2, s);
+        // Hermite basis functions
+        Vec h00 = Add(Sub(Mul(two, s3), Mul(three, s2)), one);
+        Vec h10 = Add(Sub(s3, Mul(two, s2)), s);
+        Vec h01 = Sub(one, h00);
+        Vec h11 = Sub(s3, s2);
+
+        Vec lower_weight = Load(batch.lower_weight + i);
+        Vec upper_weight = Load(batch.upper_weight + i);
+        for (size_t c = 0; c < COMPONENTS; c++)
+        {
+            size_t offset = c * batch.size + i;
+            Vec before = Load(batch.before + offset);
+            Vec lower = Load(batch.lower + offset);
+            Vec upper = Load(batch.upper + offset);
+            Vec after = Load(batch.after + offset);
+            Vec lower_tangent = Mul(Sub(upper, before), lower_weight);
+            Vec upper_tangent = Mul(Sub(after, lower), upper_weight);
+            Vec result = Add(
+                Add(Mul(h00, lower), Mul(h10, lower_tangent)),
+                Add(Mul(h01, upper), Mul(h11, upper_tangent)));
+            Store(pose + offset, c < LOCATION_COMPONENTS ? result : WrapAngle(result));
+        }
+    }
+}
+
+} // namespace
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "JitterEstimator.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    using JitterEstimator::MAX_OFFSETS;
+
+    // bounds on the playout delay, in milliseconds. the minimum is about what a LAN needs; anything past the maximum
+    // is better covered by dead reckoning than by making the ghost lag even further behind
+    const float MIN_DELAY = 20.0f;
+    const float MAX_DELAY = 500.0f;
+    // the delay has to cover this fraction of states arriving later than average
+    const float LATE_PERCENTILE = 0.95f;
+    // how fast the delay follows its target; it grows quickly so late states stop getting missed, and shrinks slowly
+    // so one calm stretch doesn't undo it
+    const float DELAY_GROW_RATE = 0.25f;
+    const float DELAY_SHRINK_RATE = 0.02f;
+    // each percent of loss adds this fraction of the usual gap between states to the delay, up to one whole gap
+    const float LOSS_GAIN = 10.0f;
+    // smoothing for the gap between states and loss; jitter uses 1/16 like RFC 3550
+    const float INTERVAL_RATE = 0.1f;
+    const float LOSS_RATE = 0.05f;
+    const float JITTER_RATE = 1.0f / 16.0f;
+}
+
+void JitterEstimator::JitterEstimator::Clear()
+{
+    *this = JitterEstimator();
+}
+
+void JitterEstimator::JitterEstimator::OnArrival(uint32_t ghost_millis, uint32_t millis, bool newest)
+{
+    int64_t transit = int64_t(millis) - int64_t(ghost_millis);
+    if (_has_transit)
+    {
+        float difference = float(std::abs(transit - _last_transit));
+        _jitter += (difference - _jitter) * JITTER_RATE;
+    }
+    _last_transit = transit;
+    _has_transit = true;
+
+    if (!newest)
+    {
+        return;
+    }
+
+    // this is a new latest state, so update offset calculation
+    int64_t offset = -transit;
+    _total_offset += offset;
+    if (_offsets_count == MAX_OFFSETS)
+    {
+        _total_offset -= _offsets[_offsets_head];
+        _offsets[_offsets_head] = offset;
+        _offsets_head = (_offsets_head + 1) % MAX_OFFSETS;
+    }
+    else
+    {
+        _offsets[(_offsets_head + _offsets_count) % MAX_OFFSETS] = offset;
+        _offsets_count++;
+    }
+
+    UpdateLoss(ghost_millis);
+    UpdateDelay();
+}
+
+bool JitterEstimator::JitterEstimator::Ready() const
+{
+    return _offsets_count > 0;
+}
+
+int64_t JitterEstimator::JitterEstimator::Offset() const
+{
+    return _total_offset / int64_t(_offsets_count);
+}
+
+float JitterEstimator::JitterEstimator::Delay() const
+{
+    return _delay;
+}
+
+float JitterEstimator::JitterEstimator::Jitter() const
+{
+    return _jitter;
+}
+
+float JitterEstimator::JitterEstimator::Loss() const
+{
+    return _loss;
+}
+
+// Estimates the usual gap between states from the gaps between newest states, and counts gaps that are much wider
+// than usual as lost states.
+void JitterEstimator::JitterEstimator::UpdateLoss(uint32_t ghost_millis)
+{
+    if (_offsets_count == 1)
+    {
+        _newest_millis = ghost_millis;
+        return;
+    }
+
+    float gap = float(ghost_millis - _newest_millis);
+    _newest_millis = ghost_millis;
+    if (_interval == 0.0f)
+    {
+        _interval = gap;
+        return;
+    }
+
+    float missing = 0.0f;
+    if (gap < 1.5f * _interval)
+    {
+        _interval += (gap - _interval) * INTERVAL_RATE;
+    }
+    else
+    {
+        missing = std::round(gap / _interval) - 1.0f;
+    }
+    // the states in the gap count as lost too, so loss moves once for each of them
+    float lost = missing / (missing + 1.0f);
+    _loss += (lost - _loss) * std::min(1.0f, LOSS_RATE * (missing + 1.0f));
+}
+
+// Moves the delay towards the spread between the average and late arrivals, plus one gap between states and some
+// headroom for jitter and loss.
+void JitterEstimator::JitterEstimator::UpdateDelay()
+{
+    // states that arrive late have the smallest offsets, so the spread is how far below average the offset gets for
+    // all but the latest few percent of states
+    std::array<int64_t, MAX_OFFSETS> sorted = _offsets;
+    auto late = sorted.begin() + size_t(float(_offsets_count) * (1.0f - LATE_PERCENTILE));
+    std::nth_element(sorted.begin(), late, sorted.begin() + _offsets_count);
+    float spread = float(Offset() - *late);
+
+    // a ghost can only be interpolated once the state after the one being played has arrived, which is up to one gap
+    // between states later
+    float target = spread + _jitter + _interval * (1.0f + std::min(1.0f, _loss * LOSS_GAIN));
+    target = std::clamp(target, MIN_DELAY, MAX_DELAY);
+    if (_delay == 0.0f)
+    {
+        _delay = target;
+        return;
+    }
+    _delay += (target - _delay) * (target > _delay ? DELAY_GROW_RATE : DELAY_SHRINK_RATE);
+}
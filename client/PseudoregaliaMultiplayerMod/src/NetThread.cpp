@@ -0,0 +1,1015 @@
+#pragma once
+
+#include "NetThread.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <codecvt>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#define WSWRAP_NO_SSL
+#define WSWRAP_NO_COMPRESSION
+#define WSWRAP_SEND_EXCEPTIONS
+#define ASIO_STANDALONE
+#define BOOST_ALL_NO_LIB
+#include "wswrap.hpp"
+#include "nlohmann/json.hpp"
+
+#include "Logger.hpp"
+#include "BitStream.hpp"
+#include "ClockSync.hpp"
+#include "PacketAcks.hpp"
+#include "PacketParity.hpp"
+#include "RotationCodec.hpp"
+#include "Settings.hpp"
+#include "SpscRing.hpp"
+#include "StateCodec.hpp"
+#include "UdpSocket.hpp"
+#include "ZoneBounds.hpp"
+
+namespace
+{
+    using NetThread::Command;
+    using NetThread::Event;
+    using NetThread::Sample;
+
+    // the first byte of every UDP packet says what the rest of it holds
+    const uint8_t PACKET_STATE = 0;
+    const uint8_t PACKET_TIME = 1;
+    const uint8_t PACKET_PARITY = 2;
+
+    // state packets start with the kind, then a PacketAcks::Header, then states encoded with StateCodec. the server's
+    // put a StateCodec::Frame before their states
+    const size_t HEADER_LEN = 6;
+    // the largest UDP payload that's never fragmented
+    const size_t MAX_PACKET_LEN = 508;
+    // besides its newest state, every update repeats up to this many of the states it sent before whose packets
+    // haven't been acked, so a lost packet's state usually still arrives with the next one
+    const size_t REDUNDANT_STATES = 2;
+    const size_t MAX_STATE_PACKET_LEN = 1 + HEADER_LEN + (1 + REDUNDANT_STATES) * StateCodec::FULL_LEN;
+    const size_t MIN_SERVER_PACKET_LEN =
+        1 + HEADER_LEN + (StateCodec::FRAME_BITS + StateCodec::MIN_FRAMED_BITS + 7) / 8;
+    const size_t MAX_STATES_PER_PACKET =
+        ((MAX_PACKET_LEN - 1 - HEADER_LEN) * 8 - StateCodec::FRAME_BITS) / StateCodec::MIN_FRAMED_BITS;
+    const size_t PING_LEN = 6;
+    const size_t PONG_LEN = 9;
+
+    const size_t SEND = MAX_STATE_PACKET_LEN;
+    const size_t RECV = MAX_PACKET_LEN;
+    static_assert(RECV == PacketParity::MAX_PACKET_LEN, "rebuilt packets must fit where received ones go");
+
+    // wswrap runs the WebSocket on an io_context of its own and only lets it be polled, so it's polled this often.
+    // commands wake the thread as they're pushed, and packets are handled as they arrive, so only messages from the
+    // server and the thread's own timers wait on this
+    const std::chrono::milliseconds WS_POLL_INTERVAL(10);
+    // how long looking up the server's address, and then getting its Connected message, can each take before the
+    // connection is given up on
+    const std::chrono::seconds RESOLVE_TIMEOUT(5);
+    const std::chrono::seconds CONNECT_TIMEOUT(10);
+
+    typedef boost::asio::ip::udp::endpoint udp_endpoint;
+
+    void Run(std::stop_token);
+    boost::asio::awaitable<void> Session(boost::asio::io_context&);
+    boost::asio::awaitable<std::optional<udp_endpoint>> Resolve(const std::string&, const std::string&);
+    bool OpenUdp(boost::asio::io_context&, const udp_endpoint&);
+    void Wake();
+    void HandleCommand(const Command&);
+    void PushEvent(Event&);
+    void Reset();
+
+    void OnOpen();
+    void OnClose();
+    void OnMessage(const std::string&);
+    void OnError(const std::string&);
+
+    void OnRecv(const boost::array<uint8_t, RECV>&, size_t);
+    void OnStates(const boost::array<uint8_t, RECV>&, size_t);
+    void OnPong(const boost::array<uint8_t, RECV>&, size_t);
+    void OnParity(const boost::array<uint8_t, RECV>&, size_t);
+    void OnErr(const std::string&);
+
+    std::wstring ToWide(const std::string&);
+    uint32_t HashW(const std::wstring&);
+
+    typedef std::chrono::steady_clock::time_point steady_time_point;
+    double LocalMillis(const steady_time_point&);
+    uint32_t ToStamp(double);
+    void TrySendPing();
+    void TryRegisterZone();
+    void SendUpdate(const Command&);
+    void ReportLink();
+
+    void WriteHeader(const PacketAcks::Header&, BitStream::Writer&);
+    PacketAcks::Header ReadHeader(BitStream::Reader&);
+
+    std::jthread thread;
+    // set by the thread as the last thing it does, so the game thread can tell when joining it won't block
+    std::atomic<bool> finished = false;
+    // the game thread pushes commands and pops events and samples; this thread does the opposite
+    SpscRing::SpscRing<Command, 64> commands;
+    SpscRing::SpscRing<Event, 256> events;
+    SpscRing::SpscRing<Sample, NetThread::SAMPLE_RING> samples;
+    // samples are dropped rather than waited on if the game thread falls behind, e.g. during a long hitch
+    uint32_t dropped_samples = 0;
+
+    // the io_context the thread is running, so the game thread can wake it up when it pushes a command. guarded by
+    // io_mutex, since the thread clears it before the io_context goes away
+    std::mutex io_mutex;
+    boost::asio::io_context* running_io = nullptr;
+    // what Session waits on between polls of the WebSocket; cancelling it makes the thread handle commands right away
+    boost::asio::steady_timer* wake_timer = nullptr;
+    // set while a wakeup is posted and hasn't run yet, so a burst of commands only posts one, and each one can reuse
+    // the same memory instead of allocating
+    std::atomic<bool> wake_posted = false;
+    UdpSocket::HandlerMemory wake_memory;
+
+    wswrap::WS* ws = nullptr;
+    UdpSocket::UdpSocket<SEND, RECV>* udp = nullptr;
+
+    NetThread::TimeSource time_source;
+    steady_time_point clock_start;
+
+    // the id given in the Connected message; this value being defined means a full connection has been established
+    std::optional<uint8_t> id = {};
+
+    // the level we're in, and its hash, which is what ZoneBounds keys zones by
+    std::string current_zone_name;
+    uint32_t current_zone = 0;
+    // states refer to zones by the index the server gives each zone's name when one of us registers it. this is ours,
+    // once the server has given it; until then no updates are sent
+    std::optional<uint8_t> current_zone_index = {};
+    bool zone_requested = false;
+    // every zone the server has told us about, by name and, for zone bounds, the hash of each index
+    std::unordered_map<std::string, uint8_t> zone_indices;
+    std::unordered_map<uint8_t, uint32_t> zone_hashes;
+    // zones a location has been clamped to the edge of the quantization box in, so each is only warned about once
+    std::unordered_set<uint32_t> unbounded_zones;
+
+    // the game thread keeps a copy of this, fed with the same pongs, for its own stamps; this one stamps when states
+    // arrive
+    ClockSync::ClockSync server_clock;
+    // the first few pings go out quickly so updates can start soon after connecting; after that they only need to
+    // keep up with drift and route changes
+    const size_t PING_BURST = 8;
+    const uint32_t PING_BURST_MILLIS = 100;
+    const uint32_t PING_MILLIS = 1000;
+    size_t pings_sent = 0;
+    uint32_t last_ping_millis = 0;
+
+    // numbers our state packets and tracks the server's, so loss and round trip time can be measured from acks. a
+    // summary is logged every LINK_REPORT_MILLIS
+    PacketAcks::PacketAcks acks;
+    const uint32_t LINK_REPORT_MILLIS = 30000;
+    uint32_t last_link_report_millis = 0;
+    // how many of its state packets the server sends a parity packet after, as given in the Connected message, or 0
+    // if it doesn't. the packets are remembered in parity so one lost from each group can be rebuilt
+    uint8_t fec_group = 0;
+    PacketParity::PacketParity parity;
+
+    // our own states by the packet they went out in, so each can be sent as a delta from the newest one the server
+    // acked
+    StateCodec::History sent_states;
+    // every player's states by the server packet they came in, so the server can send deltas from any packet we acked.
+    // players without a ghost are kept too, since the server doesn't know which ones we have
+    std::unordered_map<uint8_t, StateCodec::History> received_states;
+    // the states of the packet being received, decoded before any of them are used
+    std::array<StateCodec::WireState, MAX_STATES_PER_PACKET> decoded_states;
+}
+
+bool NetThread::Start(TimeSource source, std::chrono::steady_clock::time_point start)
+{
+    if (thread.joinable())
+    {
+        if (!finished)
+        {
+            return false;
+        }
+        thread.join();
+    }
+    // both ends are on this thread now, so the rings can be emptied for the new connection
+    commands.Clear();
+    events.Clear();
+    samples.Clear();
+    // a wakeup posted as the last thread finished never ran
+    wake_posted = false;
+
+    finished = false;
+    time_source = std::move(source);
+    clock_start = start;
+    thread = std::jthread(Run);
+    return true;
+}
+
+void NetThread::Stop()
+{
+    thread.request_stop();
+}
+
+bool NetThread::Running()
+{
+    return thread.joinable() && !thread.get_stop_token().stop_requested();
+}
+
+bool NetThread::Push(Command& command)
+{
+    if (!commands.TryPush(command))
+    {
+        return false;
+    }
+    if (!wake_posted.exchange(true))
+    {
+        std::lock_guard lock(io_mutex);
+        if (running_io)
+        {
+            boost::asio::post(*running_io,
+                boost::asio::bind_allocator(UdpSocket::HandlerAllocator<char>(wake_memory), Wake));
+        }
+        else
+        {
+            // the thread handles every command it finds when it starts
+            wake_posted = false;
+        }
+    }
+    return true;
+}
+
+bool NetThread::PopEvent(Event& event)
+{
+    return events.TryPop(event);
+}
+
+bool NetThread::PopSample(Sample& sample)
+{
+    return samples.TryPop(sample);
+}
+
+namespace
+{
+
+// The body of the thread: runs Session on an io_context of its own until it ends, either by itself or because the game
+// thread asked it to stop, which cancels whatever it's waiting on.
+void Run(std::stop_token stop)
+{
+    {
+        boost::asio::io_context io;
+        boost::asio::steady_timer wake(io);
+        wake_timer = &wake;
+        boost::asio::cancellation_signal cancel;
+        boost::asio::co_spawn(io, Session(io),
+            boost::asio::bind_cancellation_slot(cancel.slot(),
+                [](std::exception_ptr exception)
+                {
+                    if (exception)
+                    {
+                        try
+                        {
+                            std::rethrow_exception(exception);
+                        }
+                        catch (const std::exception& ex)
+                        {
+                            Log(L"Error in connection: " + ToWide(ex.what()), LogType::Error);
+                        }
+                    }
+                    // lets the io_context run out of work once the last receive has seen it was aborted
+                    if (udp)
+                    {
+                        udp->Close();
+                    }
+                    // the game thread ignores this if it's the one that stopped us
+                    Event closed{ .kind = Event::Kind::Closed };
+                    PushEvent(closed);
+                }));
+        // runs on the game thread, which mustn't touch the io_context's objects itself. it's only set up now so the
+        // cancellation is queued behind the start of Session, which would otherwise see it too early to handle it
+        std::stop_callback on_stop(stop,
+            [&]()
+            {
+                boost::asio::post(io, [&]() { cancel.emit(boost::asio::cancellation_type::terminal); });
+            });
+        {
+            std::lock_guard lock(io_mutex);
+            running_io = &io;
+        }
+        // a lookup that was given up on keeps this going until it finishes, but only this thread waits on it
+        io.run();
+        {
+            std::lock_guard lock(io_mutex);
+            running_io = nullptr;
+        }
+        wake_timer = nullptr;
+        Reset();
+    }
+    finished = true;
+}
+
+// The connection from start to finish: looks up the server's address, opens the WebSocket, waits for the Connected
+// message, opens the UDP socket, then serves both until it's cancelled. Every wait yields to the io_context, so
+// cancelling ends it right away wherever it is, and the waits on the server each have a timeout.
+boost::asio::awaitable<void> Session(boost::asio::io_context& io)
+{
+    // cancellation is checked for by hand, so it ends the session without an exception
+    co_await boost::asio::this_coro::throw_if_cancelled(false);
+    // what cancellation reaches while nothing's being waited on is only recorded here
+    auto cancellation = co_await boost::asio::this_coro::cancellation_state;
+
+    auto endpoint = co_await Resolve(Settings::GetAddress(), Settings::GetPort());
+    if (!endpoint)
+    {
+        co_return;
+    }
+
+    // by address, so wswrap doesn't look it up again without our timeout
+    auto uri = "ws://" + endpoint->address().to_string() + ":" + std::to_string(endpoint->port());
+    try
+    {
+        ws = new wswrap::WS(uri, OnOpen, OnClose, OnMessage, OnError);
+    }
+    catch (const std::exception& ex)
+    {
+        Log(L"Error connecting: " + ToWide(ex.what()), LogType::Error);
+    }
+    if (!ws)
+    {
+        co_return;
+    }
+
+    auto connect_deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+    while (true)
+    {
+        ws->poll();
+        if (id && !udp && !OpenUdp(io, *endpoint))
+        {
+            co_return;
+        }
+        if (!id && std::chrono::steady_clock::now() > connect_deadline)
+        {
+            Log(L"Timed out waiting for the server to accept the connection", LogType::Error);
+            co_return;
+        }
+
+        Command command;
+        while (commands.TryPop(command))
+        {
+            HandleCommand(command);
+        }
+        if (id)
+        {
+            TryRegisterZone();
+            TrySendPing();
+            ReportLink();
+        }
+
+        // packets are handled while this waits, and a command cuts it short
+        boost::system::error_code error;
+        wake_timer->expires_after(WS_POLL_INTERVAL);
+        co_await wake_timer->async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, error));
+        if (cancellation.cancelled() != boost::asio::cancellation_type::none)
+        {
+            co_return;
+        }
+    }
+}
+
+// Looks up the server's address, giving up after RESOLVE_TIMEOUT. asio can't interrupt a lookup, so one that's given
+// up on is left to finish in the background, and its result is thrown away.
+boost::asio::awaitable<std::optional<udp_endpoint>> Resolve(const std::string& address, const std::string& port)
+{
+    // shared with the lookup's handler, which can outlive this
+    struct Lookup
+    {
+        explicit Lookup(const boost::asio::any_io_executor& executor) : done(executor, RESOLVE_TIMEOUT) {}
+
+        boost::asio::steady_timer done;
+        bool finished = false;
+        boost::system::error_code error;
+        boost::asio::ip::udp::resolver::results_type results;
+    };
+    auto executor = co_await boost::asio::this_coro::executor;
+    auto lookup = std::make_shared<Lookup>(executor);
+
+    boost::asio::ip::udp::resolver resolver(executor);
+    resolver.async_resolve(boost::asio::ip::udp::v4(), address, port,
+        [lookup](const boost::system::error_code& error, boost::asio::ip::udp::resolver::results_type results)
+        {
+            lookup->finished = true;
+            lookup->error = error;
+            lookup->results = std::move(results);
+            lookup->done.cancel();
+        });
+    boost::system::error_code error;
+    co_await lookup->done.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, error));
+    if (!lookup->finished)
+    {
+        // otherwise we were cancelled
+        if (!error)
+        {
+            Log(L"Timed out looking up " + ToWide(address), LogType::Error);
+        }
+        co_return std::nullopt;
+    }
+    if (lookup->error || lookup->results.empty())
+    {
+        Log(L"Error connecting: " + ToWide(lookup->error ? lookup->error.message() : "no address found"),
+            LogType::Error);
+        co_return std::nullopt;
+    }
+    co_return lookup->results.begin()->endpoint();
+}
+
+// Opens the UDP socket once the server has given us an id to send with. Returns false if it couldn't be opened.
+bool OpenUdp(boost::asio::io_context& io, const udp_endpoint& endpoint)
+{
+    try
+    {
+        udp = new UdpSocket::UdpSocket<SEND, RECV>(io, endpoint, OnRecv, OnErr);
+    }
+    catch (const boost::system::system_error& ex)
+    {
+        Log(L"Error connecting: " + ToWide(ex.code().message()), LogType::Error);
+        return false;
+    }
+    return true;
+}
+
+// Runs on the thread after the game thread pushed commands, so Session stops waiting and handles them.
+void Wake()
+{
+    wake_posted = false;
+    if (wake_timer)
+    {
+        wake_timer->cancel();
+    }
+}
+
+void HandleCommand(const Command& command)
+{
+    switch (command.kind)
+    {
+    case Command::Kind::SceneLoad:
+    {
+        current_zone_name = command.zone_name;
+        current_zone = HashW(ToWide(current_zone_name));
+        zone_requested = false;
+        auto known = zone_indices.find(current_zone_name);
+        if (known == zone_indices.end())
+        {
+            current_zone_index.reset();
+            break;
+        }
+        current_zone_index = known->second;
+        Event event{ .kind = Event::Kind::ZoneIndex, .name = current_zone_name, .zone = known->second };
+        PushEvent(event);
+        break;
+    }
+    case Command::Kind::Update:
+        SendUpdate(command);
+        break;
+    }
+}
+
+// Hands event to the game thread. Events are few and each one matters, so the ring is sized never to fill up unless
+// the game thread stops taking them.
+void PushEvent(Event& event)
+{
+    if (!events.TryPush(event))
+    {
+        Log(L"Dropped network event because the game thread isn't keeping up", LogType::Warning);
+    }
+}
+
+// Closes the connection and forgets everything about it.
+void Reset()
+{
+    delete ws;
+    ws = nullptr;
+    delete udp;
+    udp = nullptr;
+
+    id.reset();
+    dropped_samples = 0;
+    current_zone_index.reset();
+    zone_requested = false;
+    zone_indices.clear();
+    zone_hashes.clear();
+    server_clock.Clear();
+    pings_sent = 0;
+    acks.Clear();
+    last_link_report_millis = 0;
+    fec_group = 0;
+    parity.Clear();
+    sent_states.Clear();
+    received_states.clear();
+}
+
+void OnOpen()
+{
+    Log(L"WebSocket connection established", LogType::Loud);
+    const auto& color = Settings::GetColor();
+    const auto& name = Settings::GetName();
+    nlohmann::json j = {
+        {"type", "Connect"},
+        {"color", color},
+        {"name", name},
+        {"fec", std::min<uint32_t>(Settings::GetFecGroup(), PacketParity::MAX_GROUP)},
+    };
+    ws->send_text(j.dump());
+}
+
+void OnClose()
+{
+    Log(L"Disconnected from server", LogType::Loud);
+    Event closed{ .kind = Event::Kind::Closed };
+    PushEvent(closed);
+}
+
+void OnMessage(const std::string& message)
+{
+    // TODO add schema validation? this function assumes a valid message
+    nlohmann::json j = nlohmann::json::parse(message);
+    const auto& field_type = j["type"];
+    if (field_type == "Connected")
+    {
+        if (id)
+        {
+            Log(L"Received Connected message after connection was already established", LogType::Warning);
+            Event closed{ .kind = Event::Kind::Closed };
+            PushEvent(closed);
+            return;
+        }
+
+        id = j["id"].template get<uint8_t>();
+        Event connected{ .kind = Event::Kind::Connected, .id = *id };
+        PushEvent(connected);
+
+        auto& field_players = j["players"];
+        for (auto it = field_players.begin(); it != field_players.end(); ++it)
+        {
+            const auto& field_color = (*it)["color"];
+            Event joined{
+                .kind = Event::Kind::PlayerJoined,
+                .id = (*it)["id"].template get<uint8_t>(),
+                .name = (*it)["name"].template get<std::string>(),
+                .color = {
+                    field_color[0].template get<uint8_t>(),
+                    field_color[1].template get<uint8_t>(),
+                    field_color[2].template get<uint8_t>(),
+                },
+            };
+            PushEvent(joined);
+        }
+
+        Log(L"Received Connected message with player id " + std::to_wstring(*id), LogType::Loud);
+
+        // servers from before parity existed leave it out
+        fec_group = j.value("fec", uint8_t(0));
+        if (fec_group != 0)
+        {
+            Log(L"Server sends a parity packet after every " + std::to_wstring(fec_group) + L" state packets",
+                LogType::Loud);
+        }
+    }
+    else if (field_type == "PlayerJoined")
+    {
+        if (!id)
+        {
+            Log(L"Received PlayerJoined message before Connected message", LogType::Warning);
+            Event closed{ .kind = Event::Kind::Closed };
+            PushEvent(closed);
+            return;
+        }
+
+        const auto& field_color = j["color"];
+        Event joined{
+            .kind = Event::Kind::PlayerJoined,
+            .id = j["id"].template get<uint8_t>(),
+            .name = j["name"].template get<std::string>(),
+            .color = {
+                field_color[0].template get<uint8_t>(),
+                field_color[1].template get<uint8_t>(),
+                field_color[2].template get<uint8_t>(),
+            },
+        };
+
+        Log(L"Received PlayerJoined message with id " + std::to_wstring(joined.id) + L" (" + ToWide(joined.name)
+                + L")",
+            LogType::Loud);
+        PushEvent(joined);
+    }
+    else if (field_type == "ZoneRegistered")
+    {
+        if (!id)
+        {
+            Log(L"Received ZoneRegistered message before Connected message", LogType::Warning);
+            Event closed{ .kind = Event::Kind::Closed };
+            PushEvent(closed);
+            return;
+        }
+
+        auto zone_name = j["name"].template get<std::string>();
+        auto zone = j["zone"].template get<uint8_t>();
+        zone_indices[zone_name] = zone;
+        zone_hashes[zone] = HashW(ToWide(zone_name));
+        Log(L"Received ZoneRegistered message with zone " + std::to_wstring(zone) + L" (" + ToWide(zone_name) + L")");
+        if (zone_name == current_zone_name)
+        {
+            current_zone_index = zone;
+            Event event{ .kind = Event::Kind::ZoneIndex, .name = zone_name, .zone = zone };
+            PushEvent(event);
+        }
+    }
+    else if (field_type == "ZoneRejected")
+    {
+        if (!id)
+        {
+            Log(L"Received ZoneRejected message before Connected message", LogType::Warning);
+            Event closed{ .kind = Event::Kind::Closed };
+            PushEvent(closed);
+            return;
+        }
+
+        Event event{
+            .kind = Event::Kind::ZoneRejected,
+            .name = j["name"].template get<std::string>(),
+            .reason = j["reason"].template get<std::string>(),
+        };
+        Log(L"Received ZoneRejected message for zone " + ToWide(event.name) + L": " + ToWide(event.reason));
+        // zone_requested stays set, so it isn't asked for again until we enter it again
+        if (event.name == current_zone_name)
+        {
+            PushEvent(event);
+        }
+    }
+    else if (field_type == "PlayerLeft")
+    {
+        if (!id)
+        {
+            Log(L"Received PlayerLeft message before Connected message", LogType::Warning);
+            Event closed{ .kind = Event::Kind::Closed };
+            PushEvent(closed);
+            return;
+        }
+
+        Event left{ .kind = Event::Kind::PlayerLeft, .id = j["id"].template get<uint8_t>() };
+        PushEvent(left);
+
+        Log(L"Received PlayerLeft message with id " + std::to_wstring(left.id), LogType::Loud);
+    }
+}
+
+void OnError(const std::string& error_message)
+{
+    Log(L"WebSocket error: " + ToWide(error_message), LogType::Error);
+}
+
+void OnRecv(const boost::array<uint8_t, RECV>& buf, size_t len)
+{
+    if (len == 0)
+    {
+        Log(L"Received packet of invalid size " + std::to_wstring(len), LogType::Warning);
+        return;
+    }
+
+    switch (buf[0])
+    {
+    case PACKET_STATE:
+        OnStates(buf, len);
+        break;
+    case PACKET_TIME:
+        OnPong(buf, len);
+        break;
+    case PACKET_PARITY:
+        OnParity(buf, len);
+        break;
+    default:
+        Log(L"Received packet of unknown kind " + std::to_wstring(buf[0]), LogType::Warning);
+        break;
+    }
+}
+
+void OnStates(const boost::array<uint8_t, RECV>& buf, size_t len)
+{
+    if (len < MIN_SERVER_PACKET_LEN || len > MAX_PACKET_LEN)
+    {
+        Log(L"Received packet of invalid size " + std::to_wstring(len), LogType::Warning);
+        return;
+    }
+
+    if (!server_clock.Ready())
+    {
+        return;
+    }
+    auto now = time_source();
+    auto millis = ToStamp(server_clock.ServerMillis(LocalMillis(now)));
+
+    BitStream::Reader reader(std::span(buf.data(), len));
+    // skip the packet kind
+    reader.Skip(8);
+    auto header = ReadHeader(reader);
+    auto frame = StateCodec::ReadFrame(reader);
+    if (!frame)
+    {
+        Log(L"Received malformed state packet", LogType::Warning);
+        return;
+    }
+
+    // every state is decoded before the packet is acked, because once it is, the server can send deltas from any
+    // state in it. if one can't be decoded, the whole packet is dropped
+    size_t num_states = 0;
+    // states are packed back to back and padded to a whole byte at the end, so a whole byte left means another state
+    while (reader.CanRead(8))
+    {
+        auto encoded = StateCodec::ReadPrefix(reader, &*frame);
+        if (!encoded || !reader.CanRead(encoded->bits) || num_states == MAX_STATES_PER_PACKET)
+        {
+            Log(L"Received malformed state packet", LogType::Warning);
+            return;
+        }
+        const StateCodec::WireState* baseline = nullptr;
+        if (encoded->age != 0)
+        {
+            auto it = received_states.find(encoded->id);
+            if (it != received_states.end())
+            {
+                baseline = it->second.Get(uint16_t(header.sequence - encoded->age));
+            }
+            if (!baseline)
+            {
+                Log(L"Received state for player with id " + std::to_wstring(encoded->id) + L" with unknown baseline",
+                    LogType::Warning);
+                return;
+            }
+        }
+        decoded_states[num_states] = StateCodec::Decode(reader, *encoded, baseline, &*frame);
+        num_states++;
+    }
+
+    if (!acks.Receive(header, uint32_t(LocalMillis(now))))
+    {
+        return;
+    }
+    if (fec_group != 0)
+    {
+        parity.Received(header.sequence, std::span(buf.data(), len));
+    }
+
+    for (size_t i = 0; i < num_states; i++)
+    {
+        const auto& wire = decoded_states[i];
+        received_states[wire.id].Put(header.sequence, wire);
+
+        // the zone's name comes over the websocket, so states in it can get here first
+        auto zone_hash = zone_hashes.find(wire.zone);
+        if (zone_hash == zone_hashes.end())
+        {
+            continue;
+        }
+        Sample sample{
+            .id = wire.id,
+            .state = {
+                .millis = wire.millis,
+                .zone = wire.zone,
+                .epoch = wire.epoch,
+                .location = ZoneBounds::Dequantize(zone_hash->second, wire.location),
+                .rotation = RotationCodec::Dequantize(wire.rotation),
+            },
+            .millis = millis,
+        };
+        if (!samples.TryPush(sample))
+        {
+            dropped_samples++;
+        }
+    }
+}
+
+void OnPong(const boost::array<uint8_t, RECV>& buf, size_t len)
+{
+    if (len != PONG_LEN)
+    {
+        Log(L"Received pong of invalid size " + std::to_wstring(len), LogType::Warning);
+        return;
+    }
+
+    auto received = uint32_t(LocalMillis(time_source()));
+    BitStream::Reader reader(std::span(buf.data(), len));
+    // skip the packet kind
+    reader.Skip(8);
+    Event pong{ .kind = Event::Kind::Pong, .received = received };
+    pong.sent = reader.Read<32>();
+    pong.server_millis = reader.Read<32>();
+
+    server_clock.OnPong(pong.sent, pong.server_millis, pong.received);
+    PushEvent(pong);
+}
+
+// Rebuilds a lost state packet from a parity packet and the rest of its group, and handles it as if it had arrived.
+void OnParity(const boost::array<uint8_t, RECV>& buf, size_t len)
+{
+    if (len < 1 + PacketParity::HEADER_LEN || fec_group == 0)
+    {
+        Log(L"Received unexpected parity packet of size " + std::to_wstring(len), LogType::Warning);
+        return;
+    }
+
+    boost::array<uint8_t, RECV> rebuilt{};
+    size_t rebuilt_len = parity.Recover(std::span(buf.data() + 1, len - 1),
+        std::span<uint8_t, PacketParity::MAX_PACKET_LEN>(rebuilt.data(), rebuilt.size()));
+    if (rebuilt_len == 0)
+    {
+        return;
+    }
+    rebuilt[0] = PACKET_STATE;
+    OnStates(rebuilt, rebuilt_len);
+}
+
+void OnErr(const std::string& error_message)
+{
+    Log(L"UDP error: " + ToWide(error_message), LogType::Error);
+    // TODO should we disconnect here?
+}
+
+// Logs a summary of the loss and round trip time measured from acks every LINK_REPORT_MILLIS.
+void ReportLink()
+{
+    auto millis = uint32_t(LocalMillis(time_source()));
+    if (millis - last_link_report_millis < LINK_REPORT_MILLIS)
+    {
+        return;
+    }
+    last_link_report_millis = millis;
+
+    const auto& stats = acks.GetStats();
+    if (stats.sent == 0)
+    {
+        return;
+    }
+    Log(L"Link to server: round trip " + std::to_wstring(std::lround(acks.Rtt())) + L" ms, loss "
+        + std::to_wstring(std::lround(acks.Loss() * 100.0f)) + L"% (" + std::to_wstring(stats.acked) + L" of "
+        + std::to_wstring(stats.sent) + L" acked), received " + std::to_wstring(stats.received) + L" ("
+        + std::to_wstring(stats.reordered) + L" reordered, " + std::to_wstring(stats.duplicates) + L" duplicates"
+        + (fec_group != 0 ? L", " + std::to_wstring(parity.Recovered()) + L" rebuilt from parity" : L"")
+        + (dropped_samples != 0 ? L", " + std::to_wstring(dropped_samples) + L" dropped by the game thread)" : L")"));
+}
+
+std::wstring ToWide(const std::string& input)
+{
+    static std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
+    return converter.from_bytes(input);
+}
+
+// Performs the 32-bit FNV-1a hash function on the input wstring.
+uint32_t HashW(const std::wstring& str)
+{
+    static_assert(sizeof(wchar_t) == 2);
+
+    uint32_t result = 0x911c9dc5; // 32-bit FNV offset basis
+    for (wchar_t wc : str)
+    {
+        // since wchar_t is 2 bytes wide, we must put each byte into the hash individually
+        auto b1 = uint8_t(wc >> 8);
+        result ^= b1;
+        result *= 0x01000193; // 32-bit FNV prime
+
+        auto b2 = uint8_t(wc);
+        result ^= b2;
+        result *= 0x01000193; // 32-bit FNV prime
+    }
+    return result;
+}
+
+// Writes the fields of header, 16 bits each, except that has_ack takes the top bit of ack_bits' 16.
+void WriteHeader(const PacketAcks::Header& header, BitStream::Writer& writer)
+{
+    writer.Write<16>(header.sequence);
+    writer.Write<16>(header.ack);
+    writer.Write<1>(header.has_ack);
+    writer.Write<PacketAcks::ACK_BITS>(header.ack_bits);
+}
+
+// Reads a header written by WriteHeader.
+PacketAcks::Header ReadHeader(BitStream::Reader& reader)
+{
+    PacketAcks::Header header{};
+    header.sequence = uint16_t(reader.Read<16>());
+    header.ack = uint16_t(reader.Read<16>());
+    header.has_ack = reader.Read<1>() != 0;
+    header.ack_bits = uint16_t(reader.Read<PacketAcks::ACK_BITS>());
+    return header;
+}
+
+// Calculates milliseconds since the UDP socket was opened.
+double LocalMillis(const steady_time_point& now)
+{
+    return std::chrono::duration<double, std::milli>(now - clock_start).count();
+}
+
+// Converts millis on the server's timeline to the whole millis states are stamped with, wrapping like the server's
+// counter does.
+uint32_t ToStamp(double millis)
+{
+    return uint32_t(int64_t(std::floor(millis)));
+}
+
+// Asks the server for the index of the zone we're in if it hasn't been given or asked for yet. The answer comes as a
+// ZoneRegistered message, or a ZoneRejected one if the server can't give it an index.
+void TryRegisterZone()
+{
+    if (current_zone_index || zone_requested)
+    {
+        return;
+    }
+    zone_requested = true;
+    nlohmann::json j = {
+        {"type", "RegisterZone"},
+        {"name", current_zone_name},
+    };
+    ws->send_text(j.dump());
+}
+
+// Sends a ping to the server to sync server_clock if it's been long enough since the last one.
+void TrySendPing()
+{
+    auto millis = uint32_t(LocalMillis(time_source()));
+    uint32_t interval = pings_sent < PING_BURST ? PING_BURST_MILLIS : PING_MILLIS;
+    if (pings_sent != 0 && millis - last_ping_millis < interval)
+    {
+        return;
+    }
+
+    boost::array<uint8_t, SEND> buf{};
+    BitStream::Writer writer(buf);
+    writer.Write<8>(PACKET_TIME);
+    writer.Write<8>(*id);
+    writer.Write<32>(millis);
+    udp->Send(buf, PING_LEN);
+    pings_sent++;
+    last_ping_millis = millis;
+}
+
+// Sends the update in command, as a delta from the newest state the server has acked if it's recent enough, followed
+// by the states of recent packets the server hasn't acked, as deltas from the new one.
+void SendUpdate(const Command& command)
+{
+    // the game thread can send one before it hears that we changed zones
+    if (!id || !current_zone_index)
+    {
+        return;
+    }
+    StateCodec::WireState state{
+        .id = *id,
+        .millis = command.millis,
+        .zone = *current_zone_index,
+        .epoch = command.epoch,
+        .rotation = RotationCodec::Quantize(command.rotation),
+    };
+
+    if (!ZoneBounds::Quantize(current_zone, command.location, state.location)
+        && unbounded_zones.insert(current_zone).second)
+    {
+        Log(L"Location is outside the quantization box of zone " + std::to_wstring(current_zone)
+                + L"; ghosts of this player will be clamped to its edge until it gets a box in ZoneBounds",
+            LogType::Warning);
+    }
+
+    // SEND has room for the largest update, so nothing written here can overflow it
+    boost::array<uint8_t, SEND> buf{};
+    BitStream::Writer writer(buf);
+    writer.Write<8>(PACKET_STATE);
+    auto header = acks.Send(uint32_t(LocalMillis(time_source())));
+    WriteHeader(header, writer);
+
+    const StateCodec::WireState* baseline = nullptr;
+    uint8_t age = 0;
+    if (auto acked = acks.NewestAcked())
+    {
+        auto since = uint16_t(header.sequence - *acked);
+        if (since <= StateCodec::MAX_AGE)
+        {
+            baseline = sent_states.Get(*acked);
+            age = uint8_t(since);
+        }
+    }
+    StateCodec::Encode(state, baseline, age, nullptr, writer);
+    // these may well have arrived with acks still on the way, but the server drops copies of states it has
+    for (uint8_t back = 1; back <= REDUNDANT_STATES; back++)
+    {
+        auto sequence = uint16_t(header.sequence - back);
+        const StateCodec::WireState* redundant = sent_states.Get(sequence);
+        if (redundant && acks.Pending(sequence))
+        {
+            StateCodec::Encode(*redundant, &state, back, nullptr, writer);
+        }
+    }
+    sent_states.Put(header.sequence, state);
+    writer.Align();
+    udp->Send(buf, writer.BytesWritten());
+}
+
+} // namespace
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "PacketAcks.hpp"
+
+namespace
+{
+    using PacketAcks::ACK_BITS;
+    using PacketAcks::MAX_SENT;
+
+    // smoothing for round trip time and loss; round trip time uses 1/8 like TCP
+    const float RTT_RATE = 1.0f / 8.0f;
+    const float LOSS_RATE = 1.0f / 32.0f;
+
+    int16_t Difference(uint16_t, uint16_t);
+}
+
+void PacketAcks::PacketAcks::Clear()
+{
+    *this = PacketAcks();
+}
+
+PacketAcks::Header PacketAcks::PacketAcks::Send(uint32_t millis)
+{
+    uint16_t sequence = _next_sequence++;
+    auto& sent = _sent[sequence & (MAX_SENT - 1)];
+    if (sent.pending)
+    {
+        // this entry is from MAX_SENT packets ago, which is too old to still be acked
+        sent.pending = false;
+        _stats.lost++;
+        _loss += (1.0f - _loss) * LOSS_RATE;
+    }
+    sent = Sent{ .millis = millis, .pending = true };
+    _stats.sent++;
+
+    return Header{ .sequence = sequence, .has_ack = _has_remote, .ack = _remote_sequence, .ack_bits = _remote_bits };
+}
+
+bool PacketAcks::PacketAcks::Receive(const Header& header, uint32_t millis)
+{
+    if (!_has_remote)
+    {
+        _remote_sequence = header.sequence;
+        _remote_bits = 0;
+        _has_remote = true;
+    }
+    else
+    {
+        int16_t ahead = Difference(header.sequence, _remote_sequence);
+        if (ahead > 0)
+        {
+            // shift the bitfield so it's relative to the new latest, marking the old latest as received
+            if (ahead > int16_t(ACK_BITS))
+            {
+                _remote_bits = 0;
+            }
+            else
+            {
+                _remote_bits = uint16_t((uint32_t(_remote_bits) << ahead) | (1u << (ahead - 1)));
+            }
+            _remote_sequence = header.sequence;
+        }
+        else if (ahead == 0 || -ahead > int16_t(ACK_BITS) || (_remote_bits & (1u << (-ahead - 1))))
+        {
+            _stats.duplicates++;
+            return false;
+        }
+        else
+        {
+            _remote_bits |= uint16_t(1u << (-ahead - 1));
+            _stats.reordered++;
+        }
+    }
+    _stats.received++;
+
+    // until the peer has received one of ours, ack is just a placeholder, and acking by it could ack a packet that
+    // was lost
+    if (!header.has_ack)
+    {
+        return true;
+    }
+    Ack(header.ack, millis);
+    for (size_t i = 0; i < ACK_BITS; i++)
+    {
+        if (header.ack_bits & (1u << i))
+        {
+            Ack(uint16_t(header.ack - 1 - i), millis);
+        }
+    }
+    return true;
+}
+
+float PacketAcks::PacketAcks::Rtt() const
+{
+    return _rtt;
+}
+
+float PacketAcks::PacketAcks::Loss() const
+{
+    return _loss;
+}
+
+std::optional<uint16_t> PacketAcks::PacketAcks::NewestAcked() const
+{
+    return _newest_acked;
+}
+
+bool PacketAcks::PacketAcks::Pending(uint16_t sequence) const
+{
+    int16_t behind = Difference(_next_sequence, sequence);
+    return behind > 0 && behind <= int16_t(MAX_SENT) && _sent[sequence & (MAX_SENT - 1)].pending;
+}
+
+const PacketAcks::Stats& PacketAcks::PacketAcks::GetStats() const
+{
+    return _stats;
+}
+
+// Marks the packet we sent with sequence as received by the peer at millis, if it's still waiting for an ack.
+void PacketAcks::PacketAcks::Ack(uint16_t sequence, uint32_t millis)
+{
+    // acks for packets we haven't sent yet are bogus, and ones from too long ago have had their entry reused
+    int16_t behind = Difference(_next_sequence, sequence);
+    if (behind <= 0 || behind > int16_t(MAX_SENT))
+    {
+        return;
+    }
+    auto& sent = _sent[sequence & (MAX_SENT - 1)];
+    if (!sent.pending)
+    {
+        return;
+    }
+
+    sent.pending = false;
+    if (!_newest_acked || Difference(sequence, *_newest_acked) > 0)
+    {
+        _newest_acked = sequence;
+    }
+    _stats.acked++;
+    _loss -= _loss * LOSS_RATE;
+    auto rtt = float(millis - sent.millis);
+    _rtt = _stats.acked == 1 ? rtt : _rtt + (rtt - _rtt) * RTT_RATE;
+}
+
+namespace
+{
+
+// Returns how far a is after b, accounting for wrapping.
+int16_t Difference(uint16_t a, uint16_t b)
+{
+    return int16_t(uint16_t(a - b));
+}
+
+} // namespace
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "PacketParity.hpp"
+
+#include <algorithm>
+#include <optional>
+
+namespace
+{
+    using PacketParity::MAX_GROUP;
+    using PacketParity::MAX_PACKET_LEN;
+
+    uint16_t ReadU16(std::span<const uint8_t>, size_t);
+}
+
+void PacketParity::PacketParity::Clear()
+{
+    *this = PacketParity();
+}
+
+void PacketParity::PacketParity::Received(uint16_t sequence, std::span<const uint8_t> packet)
+{
+    if (packet.size() < 2 || packet.size() > MAX_PACKET_LEN)
+    {
+        return;
+    }
+    auto& entry = _entries[sequence % MAX_GROUP];
+    entry.sequence = sequence;
+    entry.len = packet.size();
+    std::copy(packet.begin(), packet.end(), entry.bytes.begin());
+}
+
+size_t PacketParity::PacketParity::Recover(std::span<const uint8_t> parity, std::span<uint8_t, MAX_PACKET_LEN> out)
+{
+    if (parity.size() < HEADER_LEN || parity.size() - HEADER_LEN > MAX_PACKET_LEN - 1)
+    {
+        return 0;
+    }
+    uint16_t first = ReadU16(parity, 0);
+    size_t count = parity[2];
+    if (count == 0 || count > MAX_GROUP)
+    {
+        return 0;
+    }
+
+    // everything that arrived cancels out of the parity, leaving the packet that didn't
+    std::optional<uint16_t> missing = {};
+    size_t len = ReadU16(parity, 3);
+    auto bytes = parity.subspan(HEADER_LEN);
+    std::fill(out.begin(), out.end(), uint8_t(0));
+    std::copy(bytes.begin(), bytes.end(), out.begin() + 1);
+    for (size_t i = 0; i < count; i++)
+    {
+        auto sequence = uint16_t(first + i);
+        const auto& entry = _entries[sequence % MAX_GROUP];
+        if (entry.len == 0 || entry.sequence != sequence)
+        {
+            if (missing)
+            {
+                return 0;
+            }
+            missing = sequence;
+            continue;
+        }
+        len ^= entry.len - 1;
+        for (size_t j = 1; j < entry.len; j++)
+        {
+            out[j] ^= entry.bytes[j];
+        }
+    }
+
+    // a packet starts with its own sequence number, which is a check that the rest added up too
+    len += 1;
+    if (!missing || len < 3 || len > 1 + bytes.size() || ReadU16(std::span<const uint8_t>(out), 1) != *missing)
+    {
+        return 0;
+    }
+    _recovered++;
+    return len;
+}
+
+uint32_t PacketParity::PacketParity::Recovered() const
+{
+    return _recovered;
+}
+
+namespace
+{
+
+uint16_t ReadU16(std::span<const uint8_t> bytes, size_t offset)
+{
+    return uint16_t((bytes[offset] << 8) | bytes[offset + 1]);
+}
+
+} // namespace
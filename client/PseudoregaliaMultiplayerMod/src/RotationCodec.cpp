@@ -0,0 +1,45 @@
+#pragma once
+
+#include "RotationCodec.hpp"
+
+#include <cmath>
+
+#include "StateSchema.hpp"
+
+namespace
+{
+    using StateSchema::Layout;
+    using StateSchema::WireState;
+
+    // how many steps make up a full turn on each axis
+    const std::array<uint32_t, 3> STEPS = {
+        uint32_t(1) << Layout::WidthOf<&WireState::rotation>(0),
+        uint32_t(1) << Layout::WidthOf<&WireState::rotation>(1),
+        uint32_t(1) << Layout::WidthOf<&WireState::rotation>(2),
+    };
+    static_assert(Layout::WidthOf<&WireState::rotation>(0) <= 16 && Layout::WidthOf<&WireState::rotation>(1) <= 16
+            && Layout::WidthOf<&WireState::rotation>(2) <= 16,
+        "rotations are kept in 16 bits");
+}
+
+std::array<uint16_t, 3> RotationCodec::Quantize(const std::array<double, 3>& rotation)
+{
+    std::array<uint16_t, 3> quantized{};
+    for (size_t i = 0; i < 3; i++)
+    {
+        // rounding can land on a full turn, and anything outside [-180, 180) wraps around, so keep only the fraction
+        auto steps = int64_t(std::round((rotation[i] + 180.0) / 360.0 * STEPS[i]));
+        quantized[i] = uint16_t(steps & (STEPS[i] - 1));
+    }
+    return quantized;
+}
+
+std::array<float, 3> RotationCodec::Dequantize(const std::array<uint16_t, 3>& quantized)
+{
+    std::array<float, 3> rotation{};
+    for (size_t i = 0; i < 3; i++)
+    {
+        rotation[i] = float(quantized[i]) * (360.0f / float(STEPS[i])) - 180.0f;
+    }
+    return rotation;
+}
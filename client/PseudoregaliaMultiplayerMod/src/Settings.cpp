@@ -5,6 +5,7 @@
 #include <codecvt>
 #include <fstream>
 #include <iostream>
+#include <limits>
 
 #include "toml++/toml.hpp"
 
@@ -14,6 +15,7 @@ namespace
 {
     void ParseSetting(std::string&, toml::table, const std::string&);
     void ParseSetting(std::array<uint8_t, 3>&, toml::table, const std::string&);
+    void ParseSetting(uint32_t&, toml::table, const std::string&);
     std::wstring ToWide(const std::string&);
 
     // if you run from the executable directory
@@ -25,6 +27,9 @@ namespace
     std::string port = "23432";
     std::array<uint8_t, 3> color = { 0x00, 0x7f, 0xff };
 	std::string name = "Sybil";
+    std::string interpolation = "hermite";
+    uint32_t max_extrapolation = 200;
+    uint32_t fec_group = 0;
 }
 
 void Settings::Load()
@@ -56,6 +61,9 @@ void Settings::Load()
     ParseSetting(port, settings_table, "server.port");
     ParseSetting(color, settings_table, "sybil.color");
     ParseSetting(name, settings_table, "sybil.name");
+    ParseSetting(interpolation, settings_table, "ghosts.interpolation");
+    ParseSetting(max_extrapolation, settings_table, "ghosts.max_extrapolation_ms");
+    ParseSetting(fec_group, settings_table, "network.fec_group");
 }
 
 const std::string& Settings::GetAddress()
@@ -78,6 +86,21 @@ const std::string & Settings::GetName()
     return name;
 }
 
+const std::string& Settings::GetInterpolation()
+{
+    return interpolation;
+}
+
+uint32_t Settings::GetMaxExtrapolation()
+{
+    return max_extrapolation;
+}
+
+uint32_t Settings::GetFecGroup()
+{
+    return fec_group;
+}
+
 namespace
 {
 
@@ -130,6 +153,19 @@ void ParseSetting(std::array<uint8_t, 3>& setting, toml::table settings_table, c
     setting = { red, green, blue };
 }
 
+void ParseSetting(uint32_t& setting, toml::table settings_table, const std::string& setting_path)
+{
+    std::optional<int64_t> option = settings_table.at_path(setting_path).value<int64_t>();
+    if (!option || *option < 0 || *option > std::numeric_limits<uint32_t>::max())
+    {
+        Log(ToWide(setting_path) + L" = default (setting missing or not a non-negative integer)");
+        return;
+    }
+
+    Log(ToWide(setting_path + " = " + std::to_string(*option)));
+    setting = uint32_t(*option);
+}
+
 std::wstring ToWide(const std::string& input)
 {
     static std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
@@ -0,0 +1,410 @@
+#pragma once
+
+#include "StateCodec.hpp"
+
+namespace
+{
+    using StateCodec::FULL_LEN;
+    using StateCodec::MAX_AGE;
+    using StateCodec::WireState;
+
+    // a delta starts with the id, the baseline age, and a mask saying which fields follow and how wide they are:
+    //   bits 0-1: millis, as a delta from the baseline in 8 or 16 bits, absolute in 32, or as 8 bits back from the
+    //   baseline, for the older states a client repeats after its newest
+    //   bit 2: zone, absolute in 8 bits
+    //   bit 3: epoch, absolute in 8 bits
+    //   bits 4-9: 2 bits per location axis; unchanged, a residual in 8 or 12 bits, or absolute
+    //   bits 10-12: 1 bit per rotation axis, absolute
+    // locations are fixed point, so residuals are exact and stay small for anything moving at a sensible speed
+    using StateSchema::Layout;
+
+    const size_t ID_BITS = Layout::WidthOf<&WireState::id>();
+    const size_t AGE_BITS = 8;
+    const size_t MASK_BITS = 16;
+    const size_t MILLIS_BITS = Layout::WidthOf<&WireState::millis>();
+    const size_t ZONE_BITS = Layout::WidthOf<&WireState::zone>();
+    const size_t EPOCH_BITS = Layout::WidthOf<&WireState::epoch>();
+    const size_t LOCATION_BITS = Layout::WidthOf<&WireState::location>();
+    const std::array<size_t, 3> ROTATION_BITS = {
+        Layout::WidthOf<&WireState::rotation>(0),
+        Layout::WidthOf<&WireState::rotation>(1),
+        Layout::WidthOf<&WireState::rotation>(2),
+    };
+    const size_t FULL_BITS = ID_BITS + AGE_BITS + Layout::BITS - Layout::OFFSETS[1];
+    static_assert((FULL_BITS + 7) / 8 == FULL_LEN, "a full state is the canonical layout with the age after the id");
+    const uint16_t MILLIS_SHIFT = 0;
+    const uint16_t ZONE_BIT = 1 << 2;
+    const uint16_t EPOCH_BIT = 1 << 3;
+    const uint16_t LOCATION_SHIFT = 4;
+    const uint16_t ROTATION_SHIFT = 10;
+    const uint16_t RESERVED_BITS = 0xe000;
+
+    // widths selected by the 2 bit codes, in bits
+    const std::array<size_t, 4> MILLIS_WIDTHS = { 8, 16, MILLIS_BITS, 8 };
+    const std::array<size_t, 4> LOCATION_WIDTHS = { 0, 8, 12, LOCATION_BITS };
+    const uint16_t MILLIS_ABSOLUTE = 2;
+    const uint16_t MILLIS_BACKWARD = 3;
+    const uint16_t LOCATION_ABSOLUTE = 3;
+
+    // in a frame, a state starts with the id and a bit that's set if its age is the frame's, and otherwise followed by
+    // the age. a full state then has 2 bits saying which fields it takes from the frame: millis as a 16-bit offset
+    // from the frame's, and the zone as the frame's. the rest of the canonical layout follows from the epoch
+    const size_t FRAME_AGE_BITS = 1;
+    const size_t FRAME_MASK_BITS = 2;
+    const uint16_t FRAME_MILLIS_BIT = 1 << 0;
+    const uint16_t FRAME_ZONE_BIT = 1 << 1;
+    const size_t MILLIS_OFFSET_BITS = 16;
+    const size_t EPOCH_INDEX = Layout::IndexOf<&WireState::epoch>();
+    static_assert(EPOCH_INDEX == Layout::IndexOf<&WireState::zone>() + 1
+        && EPOCH_INDEX == Layout::IndexOf<&WireState::millis>() + 2, "full states in a frame are written in order");
+    static_assert(StateCodec::FRAME_BITS == AGE_BITS + MILLIS_BITS + ZONE_BITS, "a frame is an age, millis, and zone");
+    static_assert(StateCodec::MIN_FRAMED_BITS == ID_BITS + FRAME_AGE_BITS + MASK_BITS + 8);
+
+    uint16_t MillisCode(uint32_t);
+    uint16_t LocationCode(int32_t);
+    uint16_t FrameMask(const WireState&, const StateCodec::Frame&);
+    size_t FullBits(uint16_t, const StateCodec::Frame*);
+    size_t DeltaBits(uint16_t);
+    size_t AgeBits(uint8_t, const StateCodec::Frame*);
+    void WriteAge(uint8_t, const StateCodec::Frame*, BitStream::Writer&);
+}
+
+void StateCodec::WriteFrame(const Frame& frame, BitStream::Writer& writer)
+{
+    writer.Write<AGE_BITS>(frame.age);
+    writer.Write<MILLIS_BITS>(frame.millis);
+    writer.Write<ZONE_BITS>(frame.zone);
+}
+
+std::optional<StateCodec::Frame> StateCodec::ReadFrame(BitStream::Reader& reader)
+{
+    if (!reader.CanRead(FRAME_BITS))
+    {
+        return {};
+    }
+    Frame frame{
+        .age = uint8_t(reader.Read<AGE_BITS>()),
+        .millis = reader.Read<MILLIS_BITS>(),
+        .zone = uint8_t(reader.Read<ZONE_BITS>()),
+    };
+    if (frame.age > MAX_AGE)
+    {
+        return {};
+    }
+    return frame;
+}
+
+void StateCodec::Encode(const WireState& state, const WireState* baseline, uint8_t age, const Frame* frame,
+    BitStream::Writer& writer)
+{
+    uint16_t frame_mask = frame ? FrameMask(state, *frame) : 0;
+    writer.Write<ID_BITS>(state.id);
+    if (baseline && age != 0 && age <= MAX_AGE)
+    {
+        uint16_t mask = uint16_t(MillisCode(state.millis - baseline->millis) << MILLIS_SHIFT);
+        if (state.zone != baseline->zone)
+        {
+            mask |= ZONE_BIT;
+        }
+        if (state.epoch != baseline->epoch)
+        {
+            mask |= EPOCH_BIT;
+        }
+        for (size_t i = 0; i < 3; i++)
+        {
+            uint16_t code = LocationCode(state.location[i] - baseline->location[i]);
+            mask |= uint16_t(code << (LOCATION_SHIFT + 2 * i));
+            if (state.rotation[i] != baseline->rotation[i])
+            {
+                mask |= uint16_t(1 << (ROTATION_SHIFT + i));
+            }
+        }
+
+        if (AgeBits(age, frame) + MASK_BITS + DeltaBits(mask) < AgeBits(0, frame) + FullBits(frame_mask, frame))
+        {
+            WriteAge(age, frame, writer);
+            writer.Write<MASK_BITS>(mask);
+            uint16_t millis_code = (mask >> MILLIS_SHIFT) & 3;
+            uint32_t millis = millis_code == MILLIS_ABSOLUTE ? state.millis
+                : millis_code == MILLIS_BACKWARD             ? baseline->millis - state.millis
+                                                             : state.millis - baseline->millis;
+            writer.Write(millis, MILLIS_WIDTHS[millis_code]);
+            if (mask & ZONE_BIT)
+            {
+                writer.Write<ZONE_BITS>(state.zone);
+            }
+            if (mask & EPOCH_BIT)
+            {
+                writer.Write<EPOCH_BITS>(state.epoch);
+            }
+            for (size_t i = 0; i < 3; i++)
+            {
+                uint16_t code = (mask >> (LOCATION_SHIFT + 2 * i)) & 3;
+                int32_t value = code == LOCATION_ABSOLUTE
+                    ? state.location[i]
+                    : state.location[i] - baseline->location[i];
+                writer.Write(uint32_t(value), LOCATION_WIDTHS[code]);
+            }
+            for (size_t i = 0; i < 3; i++)
+            {
+                if (mask & (1 << (ROTATION_SHIFT + i)))
+                {
+                    writer.Write(state.rotation[i], ROTATION_BITS[i]);
+                }
+            }
+            return;
+        }
+    }
+
+    WriteAge(0, frame, writer);
+    if (!frame)
+    {
+        // the id's already written, so the rest of the canonical layout follows the age
+        Layout::Write<1>(state, writer);
+        return;
+    }
+    writer.Write<FRAME_MASK_BITS>(frame_mask);
+    if (frame_mask & FRAME_MILLIS_BIT)
+    {
+        writer.Write<MILLIS_OFFSET_BITS>(state.millis - frame->millis);
+    }
+    else
+    {
+        writer.Write<MILLIS_BITS>(state.millis);
+    }
+    if (!(frame_mask & FRAME_ZONE_BIT))
+    {
+        writer.Write<ZONE_BITS>(state.zone);
+    }
+    Layout::Write<EPOCH_INDEX>(state, writer);
+}
+
+std::optional<StateCodec::Encoded> StateCodec::ReadPrefix(BitStream::Reader& reader, const Frame* frame)
+{
+    if (!reader.CanRead(ID_BITS + (frame ? FRAME_AGE_BITS : AGE_BITS)))
+    {
+        return {};
+    }
+    Encoded encoded{ .id = uint8_t(reader.Read<ID_BITS>()) };
+    if (frame && reader.Read<FRAME_AGE_BITS>())
+    {
+        encoded.age = frame->age;
+    }
+    else
+    {
+        if (!reader.CanRead(AGE_BITS))
+        {
+            return {};
+        }
+        encoded.age = uint8_t(reader.Read<AGE_BITS>());
+    }
+    if (encoded.age > MAX_AGE)
+    {
+        return {};
+    }
+    if (encoded.age == 0)
+    {
+        if (frame)
+        {
+            if (!reader.CanRead(FRAME_MASK_BITS))
+            {
+                return {};
+            }
+            encoded.mask = uint16_t(reader.Read<FRAME_MASK_BITS>());
+        }
+        // the frame mask is part of the full state, but it's been read already
+        encoded.bits = FullBits(encoded.mask, frame) - (frame ? FRAME_MASK_BITS : 0);
+        return encoded;
+    }
+
+    if (!reader.CanRead(MASK_BITS))
+    {
+        return {};
+    }
+    encoded.mask = uint16_t(reader.Read<MASK_BITS>());
+    if (encoded.mask & RESERVED_BITS)
+    {
+        return {};
+    }
+    encoded.bits = DeltaBits(encoded.mask);
+    return encoded;
+}
+
+StateCodec::WireState StateCodec::Decode(BitStream::Reader& reader, const Encoded& encoded, const WireState* baseline,
+    const Frame* frame)
+{
+    WireState state{ .id = encoded.id };
+    if (encoded.age == 0 && !frame)
+    {
+        Layout::Read<1>(state, reader);
+        return state;
+    }
+    if (encoded.age == 0)
+    {
+        state.millis = encoded.mask & FRAME_MILLIS_BIT
+            ? frame->millis + uint32_t(reader.ReadSigned(MILLIS_OFFSET_BITS))
+            : reader.Read<MILLIS_BITS>();
+        state.zone = encoded.mask & FRAME_ZONE_BIT ? frame->zone : uint8_t(reader.Read<ZONE_BITS>());
+        Layout::Read<EPOCH_INDEX>(state, reader);
+        return state;
+    }
+
+    uint16_t mask = encoded.mask;
+    uint16_t millis_code = (mask >> MILLIS_SHIFT) & 3;
+    uint32_t millis = reader.Read(MILLIS_WIDTHS[millis_code]);
+    state.millis = millis_code == MILLIS_ABSOLUTE ? millis
+        : millis_code == MILLIS_BACKWARD          ? baseline->millis - millis
+                                                  : baseline->millis + millis;
+    state.zone = mask & ZONE_BIT ? reader.Read<ZONE_BITS>() : baseline->zone;
+    state.epoch = mask & EPOCH_BIT ? uint8_t(reader.Read<EPOCH_BITS>()) : baseline->epoch;
+    for (size_t i = 0; i < 3; i++)
+    {
+        uint16_t code = (mask >> (LOCATION_SHIFT + 2 * i)) & 3;
+        if (code == LOCATION_ABSOLUTE)
+        {
+            state.location[i] = reader.ReadSigned(LOCATION_BITS);
+        }
+        else if (code == 0)
+        {
+            state.location[i] = baseline->location[i];
+        }
+        else
+        {
+            state.location[i] = baseline->location[i] + reader.ReadSigned(LOCATION_WIDTHS[code]);
+        }
+    }
+    for (size_t i = 0; i < 3; i++)
+    {
+        state.rotation[i] = mask & (1 << (ROTATION_SHIFT + i))
+            ? uint16_t(reader.Read(ROTATION_BITS[i]))
+            : baseline->rotation[i];
+    }
+    return state;
+}
+
+void StateCodec::History::Clear()
+{
+    _entries = {};
+}
+
+void StateCodec::History::Put(uint16_t sequence, const WireState& state)
+{
+    _entries[sequence & (PacketAcks::MAX_SENT - 1)] = Entry{ .sequence = sequence, .valid = true, .state = state };
+}
+
+const StateCodec::WireState* StateCodec::History::Get(uint16_t sequence) const
+{
+    const auto& entry = _entries[sequence & (PacketAcks::MAX_SENT - 1)];
+    if (!entry.valid || entry.sequence != sequence)
+    {
+        return nullptr;
+    }
+    return &entry.state;
+}
+
+namespace
+{
+
+// Returns the code for the narrowest width a millis delta fits in.
+uint16_t MillisCode(uint32_t delta)
+{
+    if (delta <= UINT8_MAX)
+    {
+        return 0;
+    }
+    if (delta <= UINT16_MAX)
+    {
+        return 1;
+    }
+    if (uint32_t(-delta) <= UINT8_MAX)
+    {
+        return MILLIS_BACKWARD;
+    }
+    return MILLIS_ABSOLUTE;
+}
+
+// Returns the code for the narrowest width a location residual fits in.
+uint16_t LocationCode(int32_t residual)
+{
+    if (residual == 0)
+    {
+        return 0;
+    }
+    if (residual >= INT8_MIN && residual <= INT8_MAX)
+    {
+        return 1;
+    }
+    if (residual >= -(1 << 11) && residual < (1 << 11))
+    {
+        return 2;
+    }
+    return LOCATION_ABSOLUTE;
+}
+
+// Returns which fields of a full state can be taken from frame.
+uint16_t FrameMask(const WireState& state, const StateCodec::Frame& frame)
+{
+    uint16_t mask = 0;
+    auto offset = int32_t(state.millis - frame.millis);
+    if (offset >= INT16_MIN && offset <= INT16_MAX)
+    {
+        mask |= FRAME_MILLIS_BIT;
+    }
+    if (state.zone == frame.zone)
+    {
+        mask |= FRAME_ZONE_BIT;
+    }
+    return mask;
+}
+
+// Returns how many bits a full state takes up after its age, in frame if it's given, with the fields in frame_mask
+// taken from it.
+size_t FullBits(uint16_t frame_mask, const StateCodec::Frame* frame)
+{
+    if (!frame)
+    {
+        return FULL_BITS - ID_BITS - AGE_BITS;
+    }
+    return FRAME_MASK_BITS + (frame_mask & FRAME_MILLIS_BIT ? MILLIS_OFFSET_BITS : MILLIS_BITS)
+        + (frame_mask & FRAME_ZONE_BIT ? 0 : ZONE_BITS) + Layout::BITS - Layout::OFFSETS[EPOCH_INDEX];
+}
+
+// Returns how many bits the fields of a delta with mask take up.
+size_t DeltaBits(uint16_t mask)
+{
+    size_t bits = MILLIS_WIDTHS[(mask >> MILLIS_SHIFT) & 3];
+    bits += mask & ZONE_BIT ? ZONE_BITS : 0;
+    bits += mask & EPOCH_BIT ? EPOCH_BITS : 0;
+    for (size_t i = 0; i < 3; i++)
+    {
+        bits += LOCATION_WIDTHS[(mask >> (LOCATION_SHIFT + 2 * i)) & 3];
+        bits += mask & (1 << (ROTATION_SHIFT + i)) ? ROTATION_BITS[i] : 0;
+    }
+    return bits;
+}
+
+// Returns how many bits a baseline age takes up, which in frame is only one if it's the frame's.
+size_t AgeBits(uint8_t age, const StateCodec::Frame* frame)
+{
+    if (frame)
+    {
+        return FRAME_AGE_BITS + (age == frame->age ? 0 : AGE_BITS);
+    }
+    return AGE_BITS;
+}
+
+// Writes the baseline age of a state, which in frame only takes a bit if it's the frame's.
+void WriteAge(uint8_t age, const StateCodec::Frame* frame, BitStream::Writer& writer)
+{
+    if (frame)
+    {
+        writer.Write<FRAME_AGE_BITS>(age == frame->age);
+        if (age == frame->age)
+        {
+            return;
+        }
+    }
+    writer.Write<AGE_BITS>(age);
+}
+
+} // namespace
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ZoneBounds.hpp"
+
+#include <cmath>
+#include <unordered_map>
+
+#include "StateSchema.hpp"
+
+namespace
+{
+    using ZoneBounds::Box;
+    using StateSchema::WireState;
+
+    // the largest number of steps a location field can hold either side of the centre
+    const int32_t MAX_STEPS = (1 << (StateSchema::Layout::WidthOf<&WireState::location>() - 1)) - 1;
+
+    // world units are centimetres, so by default every zone gets a box centred on its origin with centimetre steps,
+    // which reaches about 5.2 km in every direction
+    const Box DEFAULT_BOX{ .center = { 0.0f, 0.0f, 0.0f }, .step = 1.0f };
+
+    // zones that don't fit the default box, by zone hash. none do so far; the client logs the hash of any zone a
+    // player leaves the box of, and giving it an entry here with a larger step or a different centre fixes it
+    const std::unordered_map<uint32_t, Box> BOXES = {};
+}
+
+const ZoneBounds::Box& ZoneBounds::For(uint32_t zone)
+{
+    auto it = BOXES.find(zone);
+    return it == BOXES.end() ? DEFAULT_BOX : it->second;
+}
+
+bool ZoneBounds::Quantize(uint32_t zone, const std::array<double, 3>& location, std::array<int32_t, 3>& quantized)
+{
+    const Box& box = For(zone);
+    bool inside = true;
+    for (size_t i = 0; i < 3; i++)
+    {
+        double steps = std::round((location[i] - box.center[i]) / box.step);
+        // written so nan counts as outside too
+        if (!(steps >= -MAX_STEPS && steps <= MAX_STEPS))
+        {
+            inside = false;
+            steps = steps < 0 ? -MAX_STEPS : MAX_STEPS;
+        }
+        quantized[i] = int32_t(steps);
+    }
+    return inside;
+}
+
+std::array<float, 3> ZoneBounds::Dequantize(uint32_t zone, const std::array<int32_t, 3>& quantized)
+{
+    const Box& box = For(zone);
+    std::array<float, 3> location{};
+    for (size_t i = 0; i < 3; i++)
+    {
+        location[i] = float(box.center[i] + double(quantized[i]) * box.step);
+    }
+    return location;
+}
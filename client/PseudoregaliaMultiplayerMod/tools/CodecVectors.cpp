@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <random>
+#include <span>
+#include <vector>
+
+#include "StateCodec.hpp"
+
+// Encodes random packets of states with the client's StateCodec, checks that it decodes them back, and prints them
+// with the states that went into them, as protocol/codec-vectors.txt. The server's tests in server/src/codec.rs encode
+// and decode the same states and check they get the same bytes, so the two codecs can't drift apart. Packets are
+// generated until every millis code and location width has come up, along with states older than their baseline and
+// packets holding two states of one player; it fails if some never do. Regenerate the file with this whenever the
+// codec changes.
+namespace
+{
+    using StateCodec::WireState;
+    using StateSchema::Layout;
+
+    // packets of each kind
+    const size_t PACKETS = 200;
+    // the most states a packet from the server gets here; few enough ids that players often repeat
+    const size_t MAX_DOWN_STATES = 6;
+    const uint8_t PLAYERS = 3;
+    const size_t BUF_LEN = 512;
+
+    // locations are signed, and rotations are unsigned fractions of a turn
+    const int32_t MAX_LOCATION = (1 << (Layout::WidthOf<&WireState::location>() - 1)) - 1;
+    const std::array<uint16_t, 3> MAX_ROTATION = {
+        uint16_t((1 << Layout::WidthOf<&WireState::rotation>(0)) - 1),
+        uint16_t((1 << Layout::WidthOf<&WireState::rotation>(1)) - 1),
+        uint16_t((1 << Layout::WidthOf<&WireState::rotation>(2)) - 1),
+    };
+
+    // One state in a packet, with what it was encoded against: nothing if baseline is empty.
+    struct Vector
+    {
+        WireState state;
+        std::optional<WireState> baseline;
+        uint8_t age;
+    };
+
+    // How often each part of the codec came up, to tell whether the vectors cover all of it.
+    struct Coverage
+    {
+        std::array<size_t, 4> millis_codes{};
+        std::array<size_t, 4> location_codes{};
+        size_t full = 0;
+        size_t framed_full = 0;
+        size_t older_than_baseline = 0;
+        size_t repeated_players = 0;
+    };
+
+    class Generator
+    {
+    public:
+        explicit Generator(uint32_t seed) : _rng(seed) {}
+
+        // The next state of a player, moved on from previous by a random amount. Picking every field's change
+        // separately makes each width come up.
+        WireState Next(const WireState& previous);
+        // A state sent earlier than newest, as the client repeats them.
+        WireState Earlier(const WireState& newest);
+        WireState First(uint8_t id);
+        uint32_t Below(uint32_t n);
+
+    private:
+        std::mt19937 _rng;
+    };
+
+    // The newest state of each player, and the one the client has acked, which states are encoded against.
+    struct Player
+    {
+        WireState newest;
+        WireState acked;
+    };
+
+    bool EncodeDown(Generator&, std::array<Player, PLAYERS>&, Coverage&);
+    bool EncodeUp(Generator&, WireState&, Coverage&);
+    bool Check(std::span<const uint8_t>, const StateCodec::Frame*, const std::vector<Vector>&, Coverage&);
+    void Print(const char* kind, std::span<const uint8_t>, const std::vector<Vector>&);
+    void PrintHex(std::span<const uint8_t>);
+}
+
+int main()
+{
+    Generator generator(1);
+    Coverage coverage;
+    std::printf("# generated by client/PseudoregaliaMultiplayerMod/tools/CodecVectors.cpp; don't edit by hand\n");
+    std::printf("# <up|down> <packet> then per state <age>:<baseline or ->:<state>, with states in the canonical"
+                " layout\n");
+
+    std::array<Player, PLAYERS> players;
+    for (uint8_t id = 0; id < PLAYERS; id++)
+    {
+        players[id].newest = generator.First(id + 1);
+        players[id].acked = players[id].newest;
+    }
+    WireState own = generator.First(PLAYERS + 1);
+    for (size_t i = 0; i < PACKETS; i++)
+    {
+        if (!EncodeDown(generator, players, coverage) || !EncodeUp(generator, own, coverage))
+        {
+            return 1;
+        }
+    }
+
+    bool covered = coverage.full != 0 && coverage.framed_full != 0 && coverage.older_than_baseline != 0
+        && coverage.repeated_players != 0;
+    for (size_t code = 0; code < 4; code++)
+    {
+        covered = covered && coverage.millis_codes[code] != 0 && coverage.location_codes[code] != 0;
+    }
+    if (!covered)
+    {
+        std::fprintf(stderr, "the vectors don't cover every part of the codec\n");
+        return 1;
+    }
+    return 0;
+}
+
+namespace
+{
+
+WireState Generator::Next(const WireState& previous)
+{
+    WireState state = previous;
+    switch (Below(8))
+    {
+    case 0:
+        // older than the baseline, close enough to go as a delta
+        state.millis -= 1 + Below(255);
+        break;
+    case 1:
+        // older, too far back for a delta
+        state.millis -= 256 + Below(100000);
+        break;
+    case 2:
+        state.millis += 256 + Below(65000);
+        break;
+    case 3:
+        state.millis += 70000 + Below(1000000);
+        break;
+    default:
+        state.millis += Below(256);
+        break;
+    }
+    if (Below(20) == 0)
+    {
+        state.zone = uint8_t(Below(256));
+    }
+    if (Below(20) == 0)
+    {
+        state.epoch++;
+    }
+    for (auto& axis : state.location)
+    {
+        // unchanged, and residuals that need 8 bits, 12 bits, or the absolute value
+        static const std::array<int32_t, 4> STEPS = { 0, 127, 2047, MAX_LOCATION };
+        int32_t step = STEPS[Below(4)];
+        axis = std::clamp(axis + int32_t(Below(2 * step + 1)) - step, -MAX_LOCATION, MAX_LOCATION);
+    }
+    for (size_t i = 0; i < 3; i++)
+    {
+        if (Below(3) == 0)
+        {
+            state.rotation[i] = uint16_t(Below(MAX_ROTATION[i] + 1));
+        }
+    }
+    return state;
+}
+
+WireState Generator::Earlier(const WireState& newest)
+{
+    WireState state = Next(newest);
+    state.millis = newest.millis - 1 - Below(255);
+    return state;
+}
+
+WireState Generator::First(uint8_t id)
+{
+    WireState state{ .id = id, .millis = uint32_t(_rng()), .zone = uint8_t(Below(256)), .epoch = uint8_t(Below(256)) };
+    for (auto& axis : state.location)
+    {
+        axis = int32_t(Below(2 * MAX_LOCATION + 1)) - MAX_LOCATION;
+    }
+    for (size_t i = 0; i < 3; i++)
+    {
+        state.rotation[i] = uint16_t(Below(MAX_ROTATION[i] + 1));
+    }
+    return state;
+}
+
+uint32_t Generator::Below(uint32_t n)
+{
+    return std::uniform_int_distribution<uint32_t>(0, n - 1)(_rng);
+}
+
+// Encodes a packet from the server: a frame, then states of the players, oldest first for each, all against the
+// state of their player the client acked last. Once the packet is acked, the last state of each player in it is the
+// one acked, as on both sides.
+bool EncodeDown(Generator& generator, std::array<Player, PLAYERS>& players, Coverage& coverage)
+{
+    std::vector<Vector> vectors;
+    size_t count = 1 + generator.Below(MAX_DOWN_STATES);
+    for (size_t i = 0; i < count; i++)
+    {
+        auto& player = players[generator.Below(PLAYERS)];
+        Vector vector{ .state = generator.Next(player.newest) };
+        // a baseline the client wouldn't have any more makes the state go in full
+        if (generator.Below(5) != 0)
+        {
+            vector.baseline = player.acked;
+            vector.age = uint8_t(1 + generator.Below(StateCodec::MAX_AGE + 4));
+        }
+        player.newest = vector.state;
+        vectors.push_back(vector);
+    }
+
+    // the server picks the frame to suit most of the states, but any frame has to work
+    bool same_age = generator.Below(2) == 0 && vectors[0].age <= StateCodec::MAX_AGE;
+    StateCodec::Frame frame{
+        .age = same_age ? vectors[0].age : uint8_t(generator.Below(StateCodec::MAX_AGE + 1)),
+        .millis = vectors[0].state.millis + (generator.Below(2) == 0 ? 0 : generator.Below(80000) - 40000),
+        .zone = generator.Below(2) == 0 ? vectors[0].state.zone : uint8_t(generator.Below(256)),
+    };
+    std::array<uint8_t, BUF_LEN> buf{};
+    BitStream::Writer writer(buf);
+    StateCodec::WriteFrame(frame, writer);
+    for (const auto& vector : vectors)
+    {
+        StateCodec::Encode(vector.state, vector.baseline ? &*vector.baseline : nullptr, vector.age, &frame, writer);
+    }
+    writer.Align();
+    std::span<const uint8_t> packet(buf.data(), writer.BytesWritten());
+
+    for (size_t i = 0; i < vectors.size(); i++)
+    {
+        for (size_t j = i + 1; j < vectors.size(); j++)
+        {
+            coverage.repeated_players += vectors[i].state.id == vectors[j].state.id;
+        }
+    }
+    if (!Check(packet, &frame, vectors, coverage))
+    {
+        return false;
+    }
+    Print("down", packet, vectors);
+    for (const auto& vector : vectors)
+    {
+        players[vector.state.id - 1].acked = vector.state;
+    }
+    return true;
+}
+
+// Encodes a packet from the client: its newest state against one it sent earlier, then up to MAX_REDUNDANT states it
+// sent before that, each against the newest.
+bool EncodeUp(Generator& generator, WireState& own, Coverage& coverage)
+{
+    std::vector<Vector> vectors;
+    Vector newest{ .state = generator.Next(own) };
+    if (generator.Below(5) != 0)
+    {
+        newest.baseline = own;
+        newest.age = uint8_t(1 + generator.Below(StateCodec::MAX_AGE));
+    }
+    own = newest.state;
+    vectors.push_back(newest);
+    size_t redundant = generator.Below(3);
+    for (uint8_t back = 1; back <= redundant; back++)
+    {
+        vectors.push_back({ .state = generator.Earlier(own), .baseline = own, .age = back });
+    }
+
+    std::array<uint8_t, BUF_LEN> buf{};
+    BitStream::Writer writer(buf);
+    for (const auto& vector : vectors)
+    {
+        StateCodec::Encode(vector.state, vector.baseline ? &*vector.baseline : nullptr, vector.age, nullptr, writer);
+    }
+    writer.Align();
+    std::span<const uint8_t> packet(buf.data(), writer.BytesWritten());
+    if (!Check(packet, nullptr, vectors, coverage))
+    {
+        return false;
+    }
+    Print("up", packet, vectors);
+    return true;
+}
+
+// Decodes packet, which holds the states of vectors after frame if it's given, and counts what came up. Returns false
+// if any state doesn't decode to what was encoded.
+bool Check(std::span<const uint8_t> packet, const StateCodec::Frame* frame, const std::vector<Vector>& vectors,
+    Coverage& coverage)
+{
+    BitStream::Reader reader(packet);
+    std::optional<StateCodec::Frame> read_frame;
+    if (frame)
+    {
+        read_frame = StateCodec::ReadFrame(reader);
+        if (!read_frame)
+        {
+            std::fprintf(stderr, "couldn't read the frame\n");
+            return false;
+        }
+    }
+    for (const auto& vector : vectors)
+    {
+        auto encoded = StateCodec::ReadPrefix(reader, read_frame ? &*read_frame : nullptr);
+        if (!encoded || !reader.CanRead(encoded->bits))
+        {
+            std::fprintf(stderr, "couldn't read the prefix of an encoded state\n");
+            return false;
+        }
+        if (encoded->age == 0)
+        {
+            coverage.full++;
+            coverage.framed_full += frame && encoded->mask != 0;
+        }
+        else
+        {
+            coverage.millis_codes[encoded->mask & 3]++;
+            for (size_t i = 0; i < 3; i++)
+            {
+                coverage.location_codes[(encoded->mask >> (4 + 2 * i)) & 3]++;
+            }
+            coverage.older_than_baseline += int32_t(vector.state.millis - vector.baseline->millis) < 0;
+        }
+        auto decoded = StateCodec::Decode(reader, *encoded, vector.baseline ? &*vector.baseline : nullptr,
+            read_frame ? &*read_frame : nullptr);
+        if (!(decoded == vector.state))
+        {
+            std::fprintf(stderr, "a state didn't decode to what was encoded\n");
+            return false;
+        }
+    }
+    if (packet.size() * 8 - reader.BitsRead() >= 8)
+    {
+        std::fprintf(stderr, "bytes were left over after the last state\n");
+        return false;
+    }
+    return true;
+}
+
+void Print(const char* kind, std::span<const uint8_t> packet, const std::vector<Vector>& vectors)
+{
+    std::printf("%s ", kind);
+    PrintHex(packet);
+    for (const auto& vector : vectors)
+    {
+        std::printf(" %u:", unsigned(vector.age));
+        if (vector.baseline)
+        {
+            PrintHex(StateSchema::ToBytes(*vector.baseline));
+        }
+        else
+        {
+            std::printf("-");
+        }
+        std::printf(":");
+        PrintHex(StateSchema::ToBytes(vector.state));
+    }
+    std::printf("\n");
+}
+
+void PrintHex(std::span<const uint8_t> bytes)
+{
+    for (uint8_t byte : bytes)
+    {
+        std::printf("%02x", byte);
+    }
+}
+
+} // namespace
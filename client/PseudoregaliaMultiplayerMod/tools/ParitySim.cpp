@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <span>
+#include <vector>
+
+#include "PacketParity.hpp"
+
+// Sends simulated state packets through a lossy link, each group of them followed by a parity packet as the server
+// does, and rebuilds what it can with PacketParity as the client does. Prints how many packets are still lost for
+// each group size and loss pattern, as the table under Parity Packets in docs/application-protocol.md, which should
+// be regenerated with this whenever MAX_GROUP, the packet caps, or the rebuild rules change.
+namespace
+{
+    // packets sent per table cell
+    const size_t PACKETS = 1000000;
+    const std::array<size_t, 4> GROUPS = { 1, 2, 4, 8 };
+    // state packets to clients that get parity are capped so the parity packet still fits in 508 bytes
+    const size_t MIN_PACKET_LEN = 12;
+    const size_t MAX_PACKET_LEN = PacketParity::MAX_PACKET_LEN - PacketParity::HEADER_LEN;
+
+    // A pattern of loss: a fraction of packets lost in bursts whose length averages burst; a burst of 1 makes every
+    // packet lost independently of the others.
+    struct Loss
+    {
+        const char* name;
+        double rate;
+        double burst;
+    };
+    const std::array<Loss, 4> LOSSES = { {
+        { "1% loss", 0.01, 1.0 },
+        { "5% loss", 0.05, 1.0 },
+        { "10% loss", 0.10, 1.0 },
+        { "5% loss, bursts of 3", 0.05, 3.0 },
+    } };
+
+    // The parity of the group of packets being sent, built the same way as Parity::add in server/src/parity.rs.
+    class Encoder
+    {
+    public:
+        explicit Encoder(size_t group) : _group(group) {}
+
+        // Adds the packet with sequence, starting with its kind, and returns true once the group is complete, with
+        // the parity packet after the kind in parity.
+        bool Add(uint16_t sequence, std::span<const uint8_t> packet, std::vector<uint8_t>& parity);
+
+    private:
+        size_t _group;
+        uint16_t _first = 0;
+        size_t _count = 0;
+        uint16_t _len = 0;
+        std::vector<uint8_t> _bytes;
+    };
+
+    // A link that drops packets with a two-state Markov chain: every packet sent while it's in the bad state is lost,
+    // and it stays there for burst packets on average. With a burst of 1, it drops each packet independently.
+    class Link
+    {
+    public:
+        Link(const Loss& loss, std::mt19937& rng);
+
+        bool Drops();
+
+    private:
+        double _enter_bad;
+        double _leave_bad;
+        bool _bad = false;
+        std::mt19937& _rng;
+        std::uniform_real_distribution<double> _uniform{ 0.0, 1.0 };
+    };
+
+    double Simulate(size_t group, const Loss& loss);
+    void PrintPercent(double);
+}
+
+int main()
+{
+    std::printf("| Group | Overhead |");
+    for (const auto& loss : LOSSES)
+    {
+        std::printf(" %s |", loss.name);
+    }
+    std::printf("\n| --- | --- |");
+    for (size_t i = 0; i < LOSSES.size(); i++)
+    {
+        std::printf(" --- |");
+    }
+    std::printf("\n");
+
+    for (size_t group : GROUPS)
+    {
+        std::printf("| %zu | %g%% |", group, 100.0 / double(group));
+        for (const auto& loss : LOSSES)
+        {
+            std::printf(" ");
+            PrintPercent(Simulate(group, loss));
+            std::printf(" |");
+        }
+        std::printf("\n");
+    }
+    return 0;
+}
+
+namespace
+{
+
+bool Encoder::Add(uint16_t sequence, std::span<const uint8_t> packet, std::vector<uint8_t>& parity)
+{
+    if (_count == 0)
+    {
+        _first = sequence;
+        _len = 0;
+        _bytes.clear();
+    }
+
+    auto payload = packet.subspan(1);
+    _len ^= uint16_t(payload.size());
+    if (_bytes.size() < payload.size())
+    {
+        _bytes.resize(payload.size(), 0);
+    }
+    for (size_t i = 0; i < payload.size(); i++)
+    {
+        _bytes[i] ^= payload[i];
+    }
+    _count++;
+    if (_count < _group)
+    {
+        return false;
+    }
+
+    parity.clear();
+    parity.push_back(uint8_t(_first >> 8));
+    parity.push_back(uint8_t(_first));
+    parity.push_back(uint8_t(_count));
+    parity.push_back(uint8_t(_len >> 8));
+    parity.push_back(uint8_t(_len));
+    parity.insert(parity.end(), _bytes.begin(), _bytes.end());
+    _count = 0;
+    return true;
+}
+
+Link::Link(const Loss& loss, std::mt19937& rng) : _rng(rng)
+{
+    // the chain spends rate of its time in the bad state
+    // a chain that always leaves the bad state right away would never drop two packets in a row, so independent loss
+    // stays in it with the same odds as entering it
+    _leave_bad = loss.burst > 1.0 ? 1.0 / loss.burst : 1.0 - loss.rate;
+    _enter_bad = loss.rate * _leave_bad / (1.0 - loss.rate);
+}
+
+bool Link::Drops()
+{
+    _bad = _uniform(_rng) < (_bad ? 1.0 - _leave_bad : _enter_bad);
+    return _bad;
+}
+
+// Returns the fraction of packets that are still lost after rebuilding, with parity after every group packets.
+double Simulate(size_t group, const Loss& loss)
+{
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<size_t> lengths(MIN_PACKET_LEN, MAX_PACKET_LEN);
+    Link link(loss, rng);
+    Encoder encoder(group);
+    PacketParity::PacketParity receiver;
+
+    // what was sent of the current group, to check rebuilt packets against
+    std::vector<std::vector<uint8_t>> sent(group);
+    std::vector<uint8_t> parity;
+    std::array<uint8_t, PacketParity::MAX_PACKET_LEN> rebuilt{};
+    size_t lost = 0;
+    size_t missing = 0;
+    for (size_t i = 0; i < PACKETS; i++)
+    {
+        // a state packet is the kind, then the header, which starts with the sequence number
+        auto sequence = uint16_t(i);
+        auto& packet = sent[i % group];
+        packet.resize(lengths(rng));
+        packet[0] = 0;
+        packet[1] = uint8_t(sequence >> 8);
+        packet[2] = uint8_t(sequence);
+        // each draw fills four bytes, which is all the checking of rebuilt packets needs
+        uint32_t bits = 0;
+        for (size_t b = 3; b < packet.size(); b++)
+        {
+            bits = (b & 3) == 3 ? rng() : bits >> 8;
+            packet[b] = uint8_t(bits);
+        }
+
+        if (link.Drops())
+        {
+            missing++;
+        }
+        else
+        {
+            receiver.Received(sequence, packet);
+        }
+        if (!encoder.Add(sequence, packet, parity))
+        {
+            continue;
+        }
+
+        // the parity packet goes through the same link, right after the group
+        bool parity_arrived = !link.Drops();
+        if (missing != 0 && parity_arrived)
+        {
+            size_t len = receiver.Recover(parity, rebuilt);
+            if (len != 0)
+            {
+                auto first = uint16_t(i + 1 - group);
+                const auto& original = sent[uint16_t((rebuilt[1] << 8 | rebuilt[2]) - first)];
+                if (len != original.size() || !std::equal(original.begin() + 1, original.end(), rebuilt.begin() + 1))
+                {
+                    std::fprintf(stderr, "rebuilt packet doesn't match what was sent\n");
+                    std::exit(1);
+                }
+                missing--;
+            }
+        }
+        lost += missing;
+        missing = 0;
+    }
+    return double(lost) / double(PACKETS);
+}
+
+// Prints fraction as a percentage with two significant digits, or at least one decimal.
+void PrintPercent(double fraction)
+{
+    double percent = 100.0 * fraction;
+    // below 0.995, two decimals don't round up to 1.00
+    std::printf(percent < 0.995 ? "%.2f%%" : "%.1f%%", percent);
+}
+
+} // namespace
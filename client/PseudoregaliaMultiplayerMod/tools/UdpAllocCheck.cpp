@@ -0,0 +1,160 @@
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "UdpSocket.hpp"
+
+// Sends packets to an echo server on loopback through UdpSocket and counts how often the thread serving it allocates
+// once it's warmed up. Fails if sending or receiving allocated at all, with whichever UDP path the build picked. Built
+// with BOOST_ASIO_DISABLE_STD_ALIGNED_ALLOC, so memory asio gets for itself goes through operator new and is counted
+// too.
+namespace
+{
+    using boost::asio::ip::udp;
+
+    // about the sizes NetThread uses: a state packet out, anything up to the UDP cap in
+    const size_t SEND = 67;
+    const size_t RECV = 508;
+    const size_t PACKET_LEN = 40;
+    const size_t WARMUP_ROUNDS = 50;
+    const size_t ROUNDS = 2000;
+    // a packet that takes this long to come back on loopback was lost
+    const std::chrono::seconds ROUND_TIMEOUT(1);
+
+    // allocations made by this thread while counting is on
+    thread_local bool counting = false;
+    thread_local size_t allocations = 0;
+
+    bool RoundTrips(boost::asio::io_context& io, UdpSocket::UdpSocket<SEND, RECV>& socket, size_t rounds,
+        size_t& received);
+    void Echo(udp::socket& echo);
+}
+
+// GCC assumes what operator new returns can't be passed to free, which doesn't hold for these replacements
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(size_t size)
+{
+    if (counting)
+    {
+        allocations++;
+    }
+    void* pointer = std::malloc(size != 0 ? size : 1);
+    if (!pointer)
+    {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    std::free(pointer);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+int main()
+{
+    boost::asio::io_context echo_io;
+    udp::socket echo(echo_io, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    std::thread echo_thread(Echo, std::ref(echo));
+
+    boost::asio::io_context io;
+    size_t received = 0;
+    size_t errors = 0;
+    UdpSocket::UdpSocket<SEND, RECV> socket(io, echo.local_endpoint(),
+        [&](const boost::array<uint8_t, RECV>&, size_t) { received++; },
+        [&](const std::string& error)
+        {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            errors++;
+        });
+
+    bool ok = RoundTrips(io, socket, WARMUP_ROUNDS, received);
+    if (ok)
+    {
+        counting = true;
+        ok = RoundTrips(io, socket, ROUNDS, received);
+        counting = false;
+    }
+
+    socket.Close();
+    io.restart();
+    io.run();
+    udp::socket stop(io, udp::v4());
+    stop.send_to(boost::asio::buffer(&PACKET_LEN, 0), echo.local_endpoint());
+    echo_thread.join();
+
+    if (!ok)
+    {
+        std::fprintf(stderr, "a packet didn't come back\n");
+        return 1;
+    }
+#if defined(UDP_MMSG)
+    const char* path = "recvmmsg/sendmmsg";
+#else
+    const char* path = "asio";
+#endif
+    std::printf("%s: %zu allocations over %zu round trips, %zu errors\n", path, allocations, ROUNDS, errors);
+    return allocations == 0 && errors == 0 ? 0 : 1;
+}
+
+namespace
+{
+
+// Sends a packet and runs io until it comes back, rounds times. Returns false if one doesn't come back in time.
+bool RoundTrips(boost::asio::io_context& io, UdpSocket::UdpSocket<SEND, RECV>& socket, size_t rounds,
+    size_t& received)
+{
+    boost::array<uint8_t, SEND> packet{};
+    for (size_t i = 0; i < rounds; i++)
+    {
+        packet[0] = uint8_t(i);
+        size_t expected = received + 1;
+        socket.Send(packet, PACKET_LEN);
+        while (received < expected)
+        {
+            if (io.run_one_for(ROUND_TIMEOUT) == 0)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Sends every packet echo gets back where it came from, until an empty one arrives.
+void Echo(udp::socket& echo)
+{
+    std::array<uint8_t, RECV> buf{};
+    udp::endpoint from;
+    while (true)
+    {
+        boost::system::error_code error;
+        size_t len = echo.receive_from(boost::asio::buffer(buf), from, 0, error);
+        if (error || len == 0)
+        {
+            return;
+        }
+        echo.send_to(boost::asio::buffer(buf, len), from, 0, error);
+    }
+}
+
+} // namespace
@@ -0,0 +1,126 @@
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <string>
+
+#include "UdpSocket.hpp"
+
+// Measures how much CPU time UdpSocket spends per packet on loopback, with whichever UDP path the build picked, so
+// the recvmmsg/sendmmsg path can be compared with the asio one. Sending goes out in groups, as the network thread
+// sends state packets, and receiving drains bursts that were already waiting, as after a hitch.
+namespace
+{
+    using boost::asio::ip::udp;
+
+    // about the sizes NetThread uses: a state packet out, anything up to the UDP cap in
+    const size_t SEND = 67;
+    const size_t RECV = 508;
+    const size_t SEND_LEN = 60;
+    const size_t RECV_LEN = 100;
+    // as many sends per group as the asio path has slots for
+    const size_t SEND_GROUP = UdpSocket::SEND_SLOTS;
+    const size_t SEND_PACKETS = 400000;
+    // as many packets per burst as one receive drains
+    const size_t RECV_BURST = UdpSocket::DRAIN_PACKETS;
+    const size_t RECV_BURSTS = 3000;
+
+    struct Counts
+    {
+        size_t received = 0;
+        size_t errors = 0;
+    };
+
+    double SendCost(boost::asio::io_context& io, UdpSocket::UdpSocket<SEND, RECV>& socket);
+    double RecvCost(boost::asio::io_context& io, udp::socket& peer, const udp::endpoint& socket_endpoint,
+        Counts& counts);
+    double CpuSeconds();
+}
+
+int main()
+{
+    boost::asio::io_context io;
+    udp::socket peer(io, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    Counts counts;
+    UdpSocket::UdpSocket<SEND, RECV> socket(io, peer.local_endpoint(),
+        [&](const boost::array<uint8_t, RECV>&, size_t) { counts.received++; },
+        [&](const std::string&) { counts.errors++; });
+
+    double send_cost = SendCost(io, socket);
+    size_t send_errors = counts.errors;
+
+    // the sends that fit in the peer's buffer tell it where the socket is
+    udp::endpoint socket_endpoint;
+    std::array<uint8_t, RECV> buf{};
+    boost::system::error_code error;
+    peer.non_blocking(true);
+    while (peer.receive_from(boost::asio::buffer(buf), socket_endpoint, 0, error), !error)
+    {
+    }
+    double recv_cost = RecvCost(io, peer, socket_endpoint, counts);
+
+#if defined(UDP_MMSG)
+    const char* path = "recvmmsg/sendmmsg";
+#else
+    const char* path = "asio";
+#endif
+    std::printf("%s: send %.2f us/packet in groups of %zu (%zu errors), receive %.2f us/packet in bursts of %zu\n",
+        path, send_cost * 1e6, SEND_GROUP, send_errors, recv_cost * 1e6, RECV_BURST);
+    socket.Close();
+    io.restart();
+    io.run();
+    return 0;
+}
+
+namespace
+{
+
+// Returns the CPU time per packet of sending SEND_PACKETS, a group at a time.
+double SendCost(boost::asio::io_context& io, UdpSocket::UdpSocket<SEND, RECV>& socket)
+{
+    boost::array<uint8_t, SEND> packet{};
+    double start = CpuSeconds();
+    for (size_t i = 0; i < SEND_PACKETS; i += SEND_GROUP)
+    {
+        for (size_t j = 0; j < SEND_GROUP; j++)
+        {
+            socket.Send(packet, SEND_LEN);
+        }
+        io.poll();
+    }
+    return (CpuSeconds() - start) / double(SEND_PACKETS);
+}
+
+// Returns the CPU time per packet the socket spends receiving RECV_BURSTS bursts that peer queued before it got to
+// run. Only the socket's side is timed.
+double RecvCost(boost::asio::io_context& io, udp::socket& peer, const udp::endpoint& socket_endpoint,
+    Counts& counts)
+{
+    std::array<uint8_t, RECV_LEN> packet{};
+    double total = 0.0;
+    size_t start_received = counts.received;
+    for (size_t i = 0; i < RECV_BURSTS; i++)
+    {
+        boost::system::error_code error;
+        for (size_t j = 0; j < RECV_BURST; j++)
+        {
+            peer.send_to(boost::asio::buffer(packet), socket_endpoint, 0, error);
+        }
+
+        size_t expected = counts.received + RECV_BURST;
+        double start = CpuSeconds();
+        while (counts.received < expected)
+        {
+            io.run_one();
+        }
+        total += CpuSeconds() - start;
+    }
+    return total / double(counts.received - start_received);
+}
+
+double CpuSeconds()
+{
+    return double(std::clock()) / CLOCKS_PER_SEC;
+}
+
+} // namespace
@@ -0,0 +1,191 @@
+use std::time::Instant;
+
+// how many packets before the latest one the ack bitfield covers; it shares 16 bits with the
+// has_ack flag
+const ACK_BITS: u16 = 15;
+const HAS_ACK: u16 = 1 << ACK_BITS;
+// number of sent packets remembered while waiting for an ack; anything not acked by the time its
+// entry is reused counts as lost
+pub const MAX_SENT: usize = 32;
+const _: () = assert!(MAX_SENT.is_power_of_two());
+const _: () = assert!(MAX_SENT > ACK_BITS as usize);
+
+// smoothing for round trip time and loss; round trip time uses 1/8 like TCP
+const RTT_RATE: f32 = 1.0 / 8.0;
+const LOSS_RATE: f32 = 1.0 / 32.0;
+
+pub const HEADER_LEN: usize = 6;
+
+/// The header at the start of every state packet, after the kind.
+#[derive(Clone, Copy)]
+pub struct Header {
+    /// the sequence number of this packet
+    pub sequence: u16,
+    /// whether anything has been received from the peer yet; if not, ack and ack_bits mean nothing
+    pub has_ack: bool,
+    /// the newest sequence number received from the peer
+    pub ack: u16,
+    /// bit i is set if sequence number ack - 1 - i was also received
+    pub ack_bits: u16,
+}
+
+impl Header {
+    /// Reads the fields 16 bits each, except that has_ack is the top bit of ack_bits' 16.
+    pub fn from_bytes(bytes: [u8; HEADER_LEN]) -> Self {
+        let bits = u16::from_be_bytes([bytes[4], bytes[5]]);
+        Self {
+            sequence: u16::from_be_bytes([bytes[0], bytes[1]]),
+            has_ack: bits & HAS_ACK != 0,
+            ack: u16::from_be_bytes([bytes[2], bytes[3]]),
+            ack_bits: bits & !HAS_ACK,
+        }
+    }
+
+    pub fn to_bytes(self) -> [u8; HEADER_LEN] {
+        let mut bytes = [0u8; HEADER_LEN];
+        bytes[0..2].copy_from_slice(&self.sequence.to_be_bytes());
+        bytes[2..4].copy_from_slice(&self.ack.to_be_bytes());
+        let has_ack = if self.has_ack { HAS_ACK } else { 0 };
+        bytes[4..6].copy_from_slice(&(self.ack_bits | has_ack).to_be_bytes());
+        bytes
+    }
+}
+
+/// Counters for diagnostics; they're never reset while a player is connected.
+#[derive(Clone, Copy, Default)]
+pub struct Stats {
+    pub sent: u32,
+    pub acked: u32,
+    pub lost: u32,
+    pub received: u32,
+    pub duplicates: u32,
+    /// packets that arrived after a newer one
+    pub reordered: u32,
+}
+
+/// Numbers the packets sent to a player, tracks which packets have been received from them, and
+/// works out from the acks in their packets which of ours made it, how long that took, and which
+/// were lost.
+pub struct Acks {
+    next_sequence: u16,
+    sent: [Option<Instant>; MAX_SENT],
+    remote: Option<(u16, u16)>,
+    rtt: Option<f32>,
+    loss: f32,
+    stats: Stats,
+}
+
+impl Acks {
+    pub fn new() -> Self {
+        Self {
+            next_sequence: 0,
+            sent: [None; MAX_SENT],
+            remote: None,
+            rtt: None,
+            loss: 0.0,
+            stats: Stats::default(),
+        }
+    }
+
+    /// Returns the header for the next packet sent at now, and remembers when it was sent.
+    pub fn send(&mut self, now: Instant) -> Header {
+        let sequence = self.next_sequence;
+        self.next_sequence = self.next_sequence.wrapping_add(1);
+        let sent = &mut self.sent[sequence as usize % MAX_SENT];
+        if sent.is_some() {
+            // this entry is from MAX_SENT packets ago, which is too old to still be acked
+            self.stats.lost += 1;
+            self.loss += (1.0 - self.loss) * LOSS_RATE;
+        }
+        *sent = Some(now);
+        self.stats.sent += 1;
+
+        let (ack, ack_bits) = self.remote.unwrap_or((0, 0));
+        Header { sequence, has_ack: self.remote.is_some(), ack, ack_bits }
+    }
+
+    /// Records a packet received from the player at now, calling on_ack with the sequence number of
+    /// each of our packets it acks for the first time. Returns false if it's a duplicate or too old
+    /// to track, in which case it should be dropped.
+    pub fn receive(&mut self, header: Header, now: Instant, mut on_ack: impl FnMut(u16)) -> bool {
+        self.remote = match self.remote {
+            None => Some((header.sequence, 0)),
+            Some((latest, bits)) => {
+                let ahead = header.sequence.wrapping_sub(latest) as i16;
+                if ahead > 0 {
+                    // shift the bitfield so it's relative to the new latest, marking the old latest
+                    // as received
+                    let ahead = ahead as u16;
+                    let bits = if ahead > ACK_BITS {
+                        0
+                    } else {
+                        (((bits as u32) << ahead) | (1 << (ahead - 1))) as u16
+                    };
+                    Some((header.sequence, bits))
+                } else {
+                    let behind = ahead.unsigned_abs();
+                    if behind == 0 || behind > ACK_BITS || bits & (1 << (behind - 1)) != 0 {
+                        self.stats.duplicates += 1;
+                        return false;
+                    }
+                    self.stats.reordered += 1;
+                    Some((latest, bits | (1 << (behind - 1))))
+                }
+            }
+        };
+        self.stats.received += 1;
+
+        // until the player has received one of ours, ack is just a placeholder, and acking by it
+        // could ack a packet that was lost
+        if !header.has_ack {
+            return true;
+        }
+        if self.ack(header.ack, now) {
+            on_ack(header.ack);
+        }
+        for i in 0..ACK_BITS {
+            let sequence = header.ack.wrapping_sub(1 + i);
+            if header.ack_bits & (1 << i) != 0 && self.ack(sequence, now) {
+                on_ack(sequence);
+            }
+        }
+        true
+    }
+
+    /// Smoothed round trip time, in milliseconds, or None if nothing has been acked yet.
+    pub fn rtt(&self) -> Option<f32> {
+        self.rtt
+    }
+
+    /// Smoothed fraction of our packets that were lost.
+    pub fn loss(&self) -> f32 {
+        self.loss
+    }
+
+    pub fn stats(&self) -> Stats {
+        self.stats
+    }
+
+    /// Marks the packet we sent with sequence as received by the player at now, if it's still
+    /// waiting for an ack. Returns whether it was.
+    fn ack(&mut self, sequence: u16, now: Instant) -> bool {
+        // acks for packets we haven't sent yet are bogus, and ones from too long ago have had their
+        // entry reused
+        let behind = self.next_sequence.wrapping_sub(sequence) as i16;
+        if behind <= 0 || behind as usize > MAX_SENT {
+            return false;
+        }
+        let Some(sent) = self.sent[sequence as usize % MAX_SENT].take() else {
+            return false;
+        };
+
+        self.stats.acked += 1;
+        self.loss -= self.loss * LOSS_RATE;
+        let rtt = now.duration_since(sent).as_secs_f32() * 1000.0;
+        self.rtt = Some(match self.rtt {
+            Some(smoothed) => smoothed + (rtt - smoothed) * RTT_RATE,
+            None => rtt,
+        });
+        true
+    }
+}
@@ -0,0 +1,107 @@
+// packs fields of any width from 0 to 32 bits into bytes and back, most significant bit first, so
+// fields that happen to be whole bytes on byte boundaries come out big endian. this is the same
+// format as BitStream.hpp on the client
+
+/// Reads the width bit field starting start bits into bytes. Panics if it runs past the end.
+pub const fn get(bytes: &[u8], start: usize, width: usize) -> u32 {
+    let mut value: u64 = 0;
+    let mut pos = start;
+    while pos < start + width {
+        // take as many bits as are left of the field in the current byte
+        let offset = pos % 8;
+        let take = if 8 - offset < start + width - pos { 8 - offset } else { start + width - pos };
+        let chunk = (bytes[pos / 8] >> (8 - offset - take)) as u64 & ((1 << take) - 1);
+        value = (value << take) | chunk;
+        pos += take;
+    }
+    value as u32
+}
+
+/// Sets the width bit field starting start bits into bytes to the low width bits of value. Panics
+/// if it runs past the end.
+pub fn set(bytes: &mut [u8], start: usize, width: usize, value: u32) {
+    for i in 0..width {
+        let pos = start + i;
+        let bit = 1 << (7 - pos % 8);
+        if (value >> (width - 1 - i)) & 1 != 0 {
+            bytes[pos / 8] |= bit;
+        } else {
+            bytes[pos / 8] &= !bit;
+        }
+    }
+}
+
+/// Writes fields onto the end of a byte buffer.
+pub struct Writer {
+    bytes: Vec<u8>,
+    // the low window_bits bits of window are written but not yet in bytes
+    window: u64,
+    window_bits: usize,
+}
+
+impl Writer {
+    pub fn with_capacity(len: usize) -> Self {
+        Self { bytes: Vec::with_capacity(len), window: 0, window_bits: 0 }
+    }
+
+    /// Writes the low width bits of value.
+    pub fn write(&mut self, value: u32, width: usize) {
+        let masked = value as u64 & ((1 << width) - 1);
+        self.window = (self.window << width) | masked;
+        self.window_bits += width;
+        while self.window_bits >= 8 {
+            self.window_bits -= 8;
+            self.bytes.push((self.window >> self.window_bits) as u8);
+        }
+    }
+
+    pub fn write_bytes(&mut self, bytes: &[u8]) {
+        for &byte in bytes {
+            self.write(byte as u32, 8);
+        }
+    }
+
+    pub fn bits_written(&self) -> usize {
+        self.bytes.len() * 8 + self.window_bits
+    }
+
+    /// Pads with zeros up to the next byte boundary and returns the bytes written.
+    pub fn finish(mut self) -> Vec<u8> {
+        if self.window_bits != 0 {
+            self.write(0, 8 - self.window_bits);
+        }
+        self.bytes
+    }
+}
+
+/// Reads fields from a byte buffer.
+pub struct Reader<'a> {
+    bytes: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Reader<'a> {
+    pub fn new(bytes: &'a [u8]) -> Self {
+        Self { bytes, pos: 0 }
+    }
+
+    /// Reads a width bit field, or returns None if there aren't that many bits left.
+    pub fn read(&mut self, width: usize) -> Option<u32> {
+        if self.pos + width > self.bytes.len() * 8 {
+            return None;
+        }
+        let value = get(self.bytes, self.pos, width);
+        self.pos += width;
+        Some(value)
+    }
+
+    /// Reads a width bit field and sign extends it; width is from 1 to 32.
+    pub fn read_signed(&mut self, width: usize) -> Option<i32> {
+        let shift = 32 - width as u32;
+        Some(((self.read(width)? << shift) as i32) >> shift)
+    }
+
+    pub fn bits_read(&self) -> usize {
+        self.pos
+    }
+}
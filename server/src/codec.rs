@@ -0,0 +1,391 @@
+use crate::{
+    acks::MAX_SENT,
+    bits::{Reader, Writer},
+    schema::{EPOCH, FIELDS, ID, LOCATION, MILLIS, ROTATION, STATE_BITS, STATE_LEN, ZONE},
+};
+
+const AGE_BITS: usize = 8;
+const MASK_BITS: usize = 16;
+
+// a full state is the id, a zero baseline age, then the rest of the canonical layout
+pub const FULL_BITS: usize = AGE_BITS + STATE_BITS;
+// the shortest delta: id, baseline age, field mask, and a one byte millis delta
+pub const MIN_LEN: usize = 5;
+// deltas can only refer back to packets the receiver still remembers
+pub const MAX_AGE: u16 = MAX_SENT as u16 - 1;
+// the longest state in a frame: a full state with its own age, millis, and zone, plus the flag bits
+pub const MAX_FRAMED_BITS: usize = FULL_BITS + FRAME_AGE_BITS + FRAME_MASK_BITS;
+// how many earlier states a client may repeat after the newest one in an upload, each as a delta
+// from the newest, in case the packets they first went out in were lost
+pub const MAX_REDUNDANT: usize = 2;
+
+// a delta starts with the id, the baseline age, and a mask saying which fields follow and how wide
+// they are:
+//   bits 0-1: millis, as a delta from the baseline in 8 or 16 bits, absolute, or as 8 bits back from
+//     the baseline, for the older states a client repeats after its newest
+//   bit 2: zone, absolute
+//   bit 3: epoch, absolute
+//   bits 4-9: 2 bits per location axis; unchanged, a residual in 8 or 12 bits, or absolute
+//   bits 10-12: 1 bit per rotation axis, absolute
+// locations are fixed point, so residuals are exact and stay small for anything moving at a
+// sensible speed
+const ZONE_BIT: u16 = 1 << 2;
+const EPOCH_BIT: u16 = 1 << 3;
+const LOCATION_SHIFT: u16 = 4;
+const ROTATION_SHIFT: u16 = 10;
+const RESERVED_BITS: u16 = 0xe000;
+
+// widths selected by the 2 bit codes, in bits
+const MILLIS_WIDTHS: [usize; 4] = [8, 16, MILLIS.width, 8];
+const LOCATION_WIDTHS: [usize; 4] = [0, 8, 12, LOCATION.width];
+const MILLIS_ABSOLUTE: u16 = 2;
+const MILLIS_BACKWARD: u16 = 3;
+const LOCATION_ABSOLUTE: u16 = 3;
+
+// in a frame, a state starts with the id and a bit that's set if its age is the frame's, and
+// otherwise followed by the age. a full state then has 2 bits saying which fields it takes from the
+// frame: millis as a 16-bit offset from the frame's, and the zone as the frame's. the rest of the
+// canonical layout follows from the epoch
+const FRAME_AGE_BITS: usize = 1;
+const FRAME_MASK_BITS: usize = 2;
+const FRAME_MILLIS_BIT: u16 = 1 << 0;
+const FRAME_ZONE_BIT: u16 = 1 << 1;
+const MILLIS_OFFSET_BITS: usize = 16;
+const EPOCH_INDEX: usize = 3;
+const _: () = assert!(FIELDS[EPOCH_INDEX].offset == EPOCH.offset);
+const _: () = assert!(MILLIS.end() == ZONE.offset && ZONE.end() == EPOCH.offset);
+
+/// What the states of a packet to a client share, written once before them. States in a frame only
+/// spend a bit on their baseline age if it's the frame's, and full ones can give their millis as an
+/// offset from the frame's and leave out their zone if it's the frame's.
+#[derive(Clone, Copy)]
+pub struct Frame {
+    pub age: u16,
+    pub millis: u32,
+    pub zone: u32,
+}
+
+impl Frame {
+    pub fn write(&self, out: &mut Writer) {
+        out.write(self.age as u32, AGE_BITS);
+        out.write(self.millis, MILLIS.width);
+        out.write(self.zone, ZONE.width);
+    }
+}
+
+/// Returns which fields of a full state can be taken from frame.
+fn frame_mask(state: &[u8; STATE_LEN], frame: &Frame) -> u16 {
+    let mut mask = 0;
+    let offset = MILLIS.read(state, 0).wrapping_sub(frame.millis) as i32;
+    if (i16::MIN as i32..=i16::MAX as i32).contains(&offset) {
+        mask |= FRAME_MILLIS_BIT;
+    }
+    if ZONE.read(state, 0) == frame.zone {
+        mask |= FRAME_ZONE_BIT;
+    }
+    mask
+}
+
+/// Returns how many bits a full state takes up after its age, in frame if it's given, with the
+/// fields in frame_mask taken from it.
+fn full_bits(frame_mask: u16, frame: Option<&Frame>) -> usize {
+    if frame.is_none() {
+        return STATE_BITS - MILLIS.offset;
+    }
+    let millis = if frame_mask & FRAME_MILLIS_BIT != 0 { MILLIS_OFFSET_BITS } else { MILLIS.width };
+    let zone = if frame_mask & FRAME_ZONE_BIT != 0 { 0 } else { ZONE.width };
+    FRAME_MASK_BITS + millis + zone + STATE_BITS - EPOCH.offset
+}
+
+/// Returns how many bits a baseline age takes up, which in frame is only one if it's the frame's.
+fn age_bits(age: u16, frame: Option<&Frame>) -> usize {
+    match frame {
+        Some(frame) => FRAME_AGE_BITS + if age == frame.age { 0 } else { AGE_BITS },
+        None => AGE_BITS,
+    }
+}
+
+/// Writes the baseline age of a state, which in frame only takes a bit if it's the frame's.
+fn write_age(age: u16, frame: Option<&Frame>, out: &mut Writer) {
+    if let Some(frame) = frame {
+        out.write((age == frame.age) as u32, FRAME_AGE_BITS);
+        if age == frame.age {
+            return;
+        }
+    }
+    out.write(age as u32, AGE_BITS);
+}
+
+/// Encodes a state onto the end of out. If baseline is given, it's the state sent age packets
+/// before this one that the receiver is known to have, and only what changed from it is written;
+/// if that wouldn't be any shorter, the full state is written instead. If frame is given, the
+/// state is written in it.
+pub fn encode(
+    state: &[u8; STATE_LEN],
+    baseline: Option<(u16, &[u8; STATE_LEN])>,
+    frame: Option<&Frame>,
+    out: &mut Writer,
+) {
+    let frame_mask = frame.map_or(0, |frame| frame_mask(state, frame));
+    out.write(ID.read(state, 0), ID.width);
+    if let Some((age, baseline)) = baseline.filter(|(age, _)| (1..=MAX_AGE).contains(age)) {
+        let millis = MILLIS.read(state, 0);
+        let millis_delta = millis.wrapping_sub(MILLIS.read(baseline, 0));
+        let millis_code = match millis_delta {
+            0..=0xff => 0,
+            0x100..=0xffff => 1,
+            _ if millis_delta.wrapping_neg() <= 0xff => MILLIS_BACKWARD,
+            _ => MILLIS_ABSOLUTE,
+        };
+        let mut mask = millis_code;
+        let mut len = MASK_BITS + MILLIS_WIDTHS[millis_code as usize];
+        if ZONE.read(state, 0) != ZONE.read(baseline, 0) {
+            mask |= ZONE_BIT;
+            len += ZONE.width;
+        }
+        if EPOCH.read(state, 0) != EPOCH.read(baseline, 0) {
+            mask |= EPOCH_BIT;
+            len += EPOCH.width;
+        }
+        let mut residuals = [0i32; 3];
+        for i in 0..3 {
+            residuals[i] = LOCATION.read_signed(state, i) - LOCATION.read_signed(baseline, i);
+            let code = match residuals[i] {
+                0 => 0,
+                -0x80..=0x7f => 1,
+                -0x800..=0x7ff => 2,
+                _ => LOCATION_ABSOLUTE,
+            };
+            mask |= code << (LOCATION_SHIFT + 2 * i as u16);
+            len += LOCATION_WIDTHS[code as usize];
+        }
+        for i in 0..3 {
+            if ROTATION[i].read(state, 0) != ROTATION[i].read(baseline, 0) {
+                mask |= 1 << (ROTATION_SHIFT + i as u16);
+                len += ROTATION[i].width;
+            }
+        }
+
+        if age_bits(age, frame) + len < age_bits(0, frame) + full_bits(frame_mask, frame) {
+            write_age(age, frame, out);
+            out.write(mask as u32, MASK_BITS);
+            let millis = match millis_code {
+                MILLIS_ABSOLUTE => millis,
+                MILLIS_BACKWARD => millis_delta.wrapping_neg(),
+                _ => millis_delta,
+            };
+            out.write(millis, MILLIS_WIDTHS[millis_code as usize]);
+            if mask & ZONE_BIT != 0 {
+                out.write(ZONE.read(state, 0), ZONE.width);
+            }
+            if mask & EPOCH_BIT != 0 {
+                out.write(EPOCH.read(state, 0), EPOCH.width);
+            }
+            for i in 0..3 {
+                let code = (mask >> (LOCATION_SHIFT + 2 * i as u16)) & 3;
+                let value = if code == LOCATION_ABSOLUTE {
+                    LOCATION.read(state, i)
+                } else {
+                    residuals[i] as u32
+                };
+                out.write(value, LOCATION_WIDTHS[code as usize]);
+            }
+            for i in 0..3 {
+                if mask & (1 << (ROTATION_SHIFT + i as u16)) != 0 {
+                    out.write(ROTATION[i].read(state, 0), ROTATION[i].width);
+                }
+            }
+            return;
+        }
+    }
+
+    write_age(0, frame, out);
+    let first = match frame {
+        // the id's already written, so the rest of the canonical layout follows the age
+        None => 1,
+        Some(frame) => {
+            out.write(frame_mask as u32, FRAME_MASK_BITS);
+            if frame_mask & FRAME_MILLIS_BIT != 0 {
+                out.write(MILLIS.read(state, 0).wrapping_sub(frame.millis), MILLIS_OFFSET_BITS);
+            } else {
+                out.write(MILLIS.read(state, 0), MILLIS.width);
+            }
+            if frame_mask & FRAME_ZONE_BIT == 0 {
+                out.write(ZONE.read(state, 0), ZONE.width);
+            }
+            EPOCH_INDEX
+        }
+    };
+    for field in &FIELDS[first..] {
+        for i in 0..field.count {
+            out.write(field.read(state, i), field.width);
+        }
+    }
+}
+
+/// Decodes the next state from reader, which was encoded in frame if it's given. baseline is called
+/// with the state's baseline age to get the state sent that many packets earlier, and isn't called
+/// for full states. Returns the state in its canonical layout, or None if it's malformed, runs past
+/// the end of the reader, or its baseline is unknown.
+pub fn decode(
+    reader: &mut Reader,
+    frame: Option<&Frame>,
+    baseline: impl FnOnce(u16) -> Option<[u8; STATE_LEN]>,
+) -> Option<[u8; STATE_LEN]> {
+    let id = reader.read(ID.width)?;
+    let age = match frame {
+        Some(frame) if reader.read(FRAME_AGE_BITS)? != 0 => frame.age,
+        _ => reader.read(AGE_BITS)? as u16,
+    };
+    if age == 0 {
+        let mut state = [0u8; STATE_LEN];
+        ID.write(&mut state, 0, id);
+        let first = match frame {
+            None => 1,
+            Some(frame) => {
+                let frame_mask = reader.read(FRAME_MASK_BITS)? as u16;
+                let millis = if frame_mask & FRAME_MILLIS_BIT != 0 {
+                    frame.millis.wrapping_add(reader.read_signed(MILLIS_OFFSET_BITS)? as u32)
+                } else {
+                    reader.read(MILLIS.width)?
+                };
+                MILLIS.write(&mut state, 0, millis);
+                let zone = if frame_mask & FRAME_ZONE_BIT != 0 {
+                    frame.zone
+                } else {
+                    reader.read(ZONE.width)?
+                };
+                ZONE.write(&mut state, 0, zone);
+                EPOCH_INDEX
+            }
+        };
+        for field in &FIELDS[first..] {
+            for i in 0..field.count {
+                field.write(&mut state, i, reader.read(field.width)?);
+            }
+        }
+        return Some(state);
+    }
+    if age > MAX_AGE {
+        return None;
+    }
+
+    let mask = reader.read(MASK_BITS)? as u16;
+    let millis_code = mask & 3;
+    if mask & RESERVED_BITS != 0 {
+        return None;
+    }
+
+    let mut state = baseline(age)?;
+    ID.write(&mut state, 0, id);
+    let millis = reader.read(MILLIS_WIDTHS[millis_code as usize])?;
+    let millis = match millis_code {
+        MILLIS_ABSOLUTE => millis,
+        MILLIS_BACKWARD => MILLIS.read(&state, 0).wrapping_sub(millis),
+        _ => MILLIS.read(&state, 0).wrapping_add(millis),
+    };
+    MILLIS.write(&mut state, 0, millis);
+    if mask & ZONE_BIT != 0 {
+        ZONE.write(&mut state, 0, reader.read(ZONE.width)?);
+    }
+    if mask & EPOCH_BIT != 0 {
+        EPOCH.write(&mut state, 0, reader.read(EPOCH.width)?);
+    }
+    for i in 0..3 {
+        let code = (mask >> (LOCATION_SHIFT + 2 * i as u16)) & 3;
+        let width = LOCATION_WIDTHS[code as usize];
+        let value = match code {
+            0 => continue,
+            LOCATION_ABSOLUTE => reader.read(width)?,
+            _ => LOCATION.read_signed(&state, i).wrapping_add(reader.read_signed(width)?) as u32,
+        };
+        LOCATION.write(&mut state, i, value);
+    }
+    for i in 0..3 {
+        if mask & (1 << (ROTATION_SHIFT + i as u16)) != 0 {
+            ROTATION[i].write(&mut state, 0, reader.read(ROTATION[i].width)?);
+        }
+    }
+    Some(state)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    // packets the client's codec wrote, with the states in them; see the header for the format
+    const VECTORS: &str = include_str!("../../protocol/codec-vectors.txt");
+
+    struct Vector {
+        age: u16,
+        baseline: Option<[u8; STATE_LEN]>,
+        state: [u8; STATE_LEN],
+    }
+
+    fn hex(text: &str) -> Vec<u8> {
+        (0..text.len())
+            .step_by(2)
+            .map(|i| u8::from_str_radix(&text[i..i + 2], 16).unwrap())
+            .collect()
+    }
+
+    fn state(text: &str) -> [u8; STATE_LEN] {
+        hex(text).try_into().unwrap()
+    }
+
+    /// Returns whether each packet is a download, its bytes, and its states.
+    fn packets() -> impl Iterator<Item = (bool, Vec<u8>, Vec<Vector>)> {
+        VECTORS.lines().filter(|line| !line.starts_with('#')).map(|line| {
+            let mut words = line.split(' ');
+            let down = words.next() == Some("down");
+            let packet = hex(words.next().unwrap());
+            let vectors = words
+                .map(|word| {
+                    let mut parts = word.split(':');
+                    let age = parts.next().unwrap().parse().unwrap();
+                    let baseline = parts.next().filter(|&text| text != "-").map(state);
+                    Vector { age, baseline, state: state(parts.next().unwrap()) }
+                })
+                .collect();
+            (down, packet, vectors)
+        })
+    }
+
+    fn read_frame(reader: &mut Reader) -> Frame {
+        let age = reader.read(AGE_BITS).unwrap() as u16;
+        let millis = reader.read(MILLIS.width).unwrap();
+        Frame { age, millis, zone: reader.read(ZONE.width).unwrap() }
+    }
+
+    #[test]
+    fn encodes_like_the_client() {
+        for (down, packet, vectors) in packets() {
+            let mut out = Writer::with_capacity(packet.len());
+            let frame = down.then(|| read_frame(&mut Reader::new(&packet)));
+            if let Some(frame) = &frame {
+                frame.write(&mut out);
+            }
+            for vector in &vectors {
+                let baseline = vector.baseline.as_ref().map(|baseline| (vector.age, baseline));
+                encode(&vector.state, baseline, frame.as_ref(), &mut out);
+            }
+            assert_eq!(out.finish(), packet);
+        }
+    }
+
+    #[test]
+    fn decodes_what_the_client_encodes() {
+        for (down, packet, vectors) in packets() {
+            let mut reader = Reader::new(&packet);
+            let frame = down.then(|| read_frame(&mut reader));
+            for vector in &vectors {
+                let decoded = decode(&mut reader, frame.as_ref(), |age| {
+                    assert_eq!(age, vector.age);
+                    vector.baseline
+                });
+                assert_eq!(decoded, Some(vector.state));
+            }
+            assert_eq!(reader.bits_read().div_ceil(8), packet.len());
+        }
+    }
+}
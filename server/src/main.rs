@@ -6,7 +6,12 @@ use std::{
 };
 use tokio::net::{TcpListener, UdpSocket};
 
+mod acks;
+mod bits;
+mod codec;
 mod message;
+mod parity;
+mod schema;
 mod serve;
 mod state;
 
@@ -10,19 +10,25 @@ pub struct PlayerInfo {
 #[derive(Serialize)]
 #[serde(tag = "type")]
 pub enum ServerMessage {
-    Connected { id: u8, players: Vec<PlayerInfo> },
+    Connected { id: u8, players: Vec<PlayerInfo>, fec: u8 },
     PlayerJoined { id: u8, color: [u8; 3], name: String },
     PlayerLeft { id: u8 },
+    ZoneRegistered { zone: u8, name: String },
+    ZoneRejected { name: String, reason: String },
 }
 
 #[derive(Deserialize)]
 pub struct ConnectInfo {
     pub color: [u8; 3],
     pub name: String,
+    // how many state packets to send a parity packet after, or 0 for none
+    #[serde(default)]
+    pub fec: u8,
 }
 
 #[derive(Deserialize)]
 #[serde(tag = "type")]
 pub enum ClientMessage {
     Connect(ConnectInfo),
+    RegisterZone { name: String },
 }
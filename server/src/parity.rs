@@ -0,0 +1,67 @@
+// xor parity over groups of consecutive state packets sent to a player, so that they can rebuild any
+// one packet of a group that's lost from the rest of it and the parity, without anything being
+// resent. a group of 1 makes the parity a copy of every packet, which is plain redundancy
+
+/// The most packets one parity packet can cover; clients remember this many to rebuild from.
+pub const MAX_GROUP: u8 = 8;
+// a parity packet is the kind, then this header: the sequence number of the first packet it covers,
+// how many packets it covers, and the xor of their lengths after the kind. then comes the xor of
+// their bytes after the kind, with the shorter ones padded with zeros
+pub const HEADER_LEN: usize = 5;
+
+/// Returns the group size to use for a client that asked for requested, or 0 if it didn't ask for
+/// parity at all.
+pub fn group_len(requested: u8) -> u8 {
+    requested.min(MAX_GROUP)
+}
+
+/// The parity of the group of packets currently being sent to a player.
+pub struct Parity {
+    group: u8,
+    first: u16,
+    count: u8,
+    len: u16,
+    bytes: Vec<u8>,
+}
+
+impl Parity {
+    pub fn new(group: u8) -> Self {
+        Self { group, first: 0, count: 0, len: 0, bytes: Vec::new() }
+    }
+
+    /// Adds the state packet with sequence, starting with its kind, to the current group. Returns
+    /// the parity packet after the kind once the group is complete.
+    pub fn add(&mut self, sequence: u16, packet: &[u8]) -> Option<Vec<u8>> {
+        // sequence numbers to a player only skip if a packet couldn't be sent at all, and the client
+        // can't rebuild across a gap, so start the group over
+        if self.count != 0 && sequence != self.first.wrapping_add(self.count as u16) {
+            self.count = 0;
+        }
+        if self.count == 0 {
+            self.first = sequence;
+            self.len = 0;
+            self.bytes.clear();
+        }
+
+        let payload = &packet[1..];
+        self.len ^= payload.len() as u16;
+        if self.bytes.len() < payload.len() {
+            self.bytes.resize(payload.len(), 0);
+        }
+        for (parity, byte) in self.bytes.iter_mut().zip(payload) {
+            *parity ^= byte;
+        }
+        self.count += 1;
+        if self.count < self.group {
+            return None;
+        }
+
+        let mut parity = Vec::with_capacity(HEADER_LEN + self.bytes.len());
+        parity.extend_from_slice(&self.first.to_be_bytes());
+        parity.push(self.count);
+        parity.extend_from_slice(&self.len.to_be_bytes());
+        parity.extend_from_slice(&self.bytes);
+        self.count = 0;
+        Some(parity)
+    }
+}
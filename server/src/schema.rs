@@ -0,0 +1,99 @@
+use crate::bits;
+
+/// A field of the canonical state layout: where it starts, how many bits each of its elements
+/// takes up, and how many elements it has.
+#[derive(Clone, Copy)]
+pub struct Field {
+    pub offset: usize,
+    pub width: usize,
+    pub count: usize,
+}
+
+impl Field {
+    /// The bit element i of the field starts at.
+    pub const fn start(self, i: usize) -> usize {
+        self.offset + self.width * i
+    }
+
+    /// The first bit after the field.
+    pub const fn end(self) -> usize {
+        self.start(self.count)
+    }
+
+    /// Reads element i of the field out of state.
+    pub const fn read(self, state: &[u8; STATE_LEN], i: usize) -> u32 {
+        bits::get(state, self.start(i), self.width)
+    }
+
+    /// Reads element i of the field out of state and sign extends it.
+    pub const fn read_signed(self, state: &[u8; STATE_LEN], i: usize) -> i32 {
+        let shift = 32 - self.width as u32;
+        ((self.read(state, i) << shift) as i32) >> shift
+    }
+
+    /// Writes the low bits of value into element i of the field in state.
+    pub fn write(self, state: &mut [u8; STATE_LEN], i: usize, value: u32) {
+        bits::set(state, self.start(i), self.width, value);
+    }
+}
+
+/// Returns the field that comes right after previous.
+const fn after(previous: Field, width: usize, count: usize) -> Field {
+    Field { offset: previous.end(), width, count }
+}
+
+// the canonical layout the server stores player states in, padded with zeros to a whole number of
+// bytes, which is also how full states go over the wire, with the baseline age after the id. the
+// client generates its layout from the same list, so this has to stay in the same order and widths
+// as Layout in StateSchema.hpp
+pub const ID: Field = Field { offset: 0, width: 8, count: 1 };
+pub const MILLIS: Field = after(ID, 32, 1);
+// an index into the zone table; see register_zone in state.rs
+pub const ZONE: Field = after(MILLIS, 8, 1);
+pub const EPOCH: Field = after(ZONE, 8, 1);
+// fixed point, in steps from the centre of the zone's box, which only the clients need to know
+pub const LOCATION: Field = after(EPOCH, 20, 3);
+// fixed point fractions of a turn, with the most bits going to yaw (z)
+const ROTATION_X: Field = after(LOCATION, 11, 1);
+const ROTATION_Y: Field = after(ROTATION_X, 11, 1);
+const ROTATION_Z: Field = after(ROTATION_Y, 12, 1);
+pub const ROTATION: [Field; 3] = [ROTATION_X, ROTATION_Y, ROTATION_Z];
+pub const FIELDS: [Field; 8] =
+    [ID, MILLIS, ZONE, EPOCH, LOCATION, ROTATION_X, ROTATION_Y, ROTATION_Z];
+pub const STATE_BITS: usize = ROTATION_Z.end();
+pub const STATE_LEN: usize = STATE_BITS.div_ceil(8);
+
+// the golden fixture the client checks its layout against too; see the file for the values
+const GOLDEN: [u8; STATE_LEN] = from_hex(include!("../../protocol/canonical-state.inc"));
+const _: () = assert!(ID.read(&GOLDEN, 0) == 7);
+const _: () = assert!(MILLIS.read(&GOLDEN, 0) == 0x01234567);
+const _: () = assert!(ZONE.read(&GOLDEN, 0) == 0xcd);
+const _: () = assert!(EPOCH.read(&GOLDEN, 0) == 42);
+const _: () = assert!(LOCATION.read_signed(&GOLDEN, 0) == 150);
+const _: () = assert!(LOCATION.read_signed(&GOLDEN, 1) == -225);
+const _: () = assert!(LOCATION.read_signed(&GOLDEN, 2) == 102400);
+const _: () = assert!(ROTATION_X.read(&GOLDEN, 0) == 16);
+const _: () = assert!(ROTATION_Y.read(&GOLDEN, 0) == 1024);
+const _: () = assert!(ROTATION_Z.read(&GOLDEN, 0) == 4095);
+const _: () = assert!(bits::get(&GOLDEN, STATE_BITS, STATE_LEN * 8 - STATE_BITS) == 0);
+
+/// Parses the golden fixture's hex, failing the build if it's a different length than the layout.
+const fn from_hex(hex: &str) -> [u8; STATE_LEN] {
+    const fn digit(c: u8) -> u8 {
+        match c {
+            b'0'..=b'9' => c - b'0',
+            b'a'..=b'f' => c - b'a' + 10,
+            _ => panic!("the golden fixture isn't lowercase hex"),
+        }
+    }
+
+    let hex = hex.as_bytes();
+    assert!(hex.len() == 2 * STATE_LEN, "the golden fixture is a different length than the layout");
+    let mut bytes = [0u8; STATE_LEN];
+    let mut i = 0;
+    while i < STATE_LEN {
+        bytes[i] = (digit(hex[2 * i]) << 4) | digit(hex[2 * i + 1]);
+        i += 1;
+    }
+    bytes
+}
@@ -1,7 +1,11 @@
-use crate::state::{PlayerState, STATE_LEN, State};
+use crate::{
+    acks::{HEADER_LEN, Header},
+    state::State,
+};
 use std::{
     io, process,
     sync::{Arc, Mutex},
+    time::Instant,
 };
 use tokio::net::{TcpListener, UdpSocket};
 
@@ -37,22 +41,37 @@ pub async fn tcp(state: Arc<Mutex<State>>, tcp_listener: TcpListener) -> String
 }
 
 pub async fn udp(state: Arc<Mutex<State>>, udp_socket: UdpSocket) -> String {
-    let mut buf = [0u8; STATE_LEN];
+    let mut buf = [0u8; udp::MAX_CLIENT_PACKET_LEN];
     let udp_socket = Arc::new(udp_socket);
+    // clients stamp their states with this clock, so every player shares one timeline
+    let clock = Instant::now();
     loop {
         match udp_socket.recv_from(&mut buf).await {
-            Ok((len, addr)) => {
-                if len != STATE_LEN {
-                    println!("received UDP packet of the incorrect length: {len}");
-                    continue;
+            Ok((len, addr)) => match (len, buf[0]) {
+                (udp::MIN_STATE_PACKET_LEN..=udp::MAX_STATE_PACKET_LEN, udp::PACKET_STATE) => {
+                    let header: [u8; HEADER_LEN] = buf[1..1 + HEADER_LEN].try_into().unwrap();
+                    tokio::spawn(udp::handle_packet(
+                        state.clone(),
+                        Header::from_bytes(header),
+                        buf[1 + HEADER_LEN..len].to_vec(),
+                        udp_socket.clone(),
+                        addr,
+                    ));
                 }
-                tokio::spawn(udp::handle_packet(
-                    state.clone(),
-                    PlayerState::from_bytes(buf),
-                    udp_socket.clone(),
-                    addr,
-                ));
-            }
+                (udp::PING_LEN, udp::PACKET_TIME) => {
+                    // stamp the ping as soon as it arrives so the client's round trip is split evenly
+                    let millis = clock.elapsed().as_millis() as u32;
+                    let ping: [u8; udp::PING_LEN] = buf[..udp::PING_LEN].try_into().unwrap();
+                    tokio::spawn(udp::handle_ping(
+                        state.clone(),
+                        ping,
+                        millis,
+                        udp_socket.clone(),
+                        addr,
+                    ));
+                }
+                _ => println!("received UDP packet of unknown kind or incorrect length: {len}"),
+            },
             // TODO does this need to return? or can the socket continue to receive packets?
             Err(err) => return format!("failed to read UDP socket: {err}"),
         }
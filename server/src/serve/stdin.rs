@@ -4,16 +4,43 @@ use std::{
     sync::{Arc, Mutex},
 };
 
-pub fn handle_command(_state: &Arc<Mutex<State>>, command: &str) {
-    // We don't use state yet but it could theoretically be used for all sorts of things
+pub fn handle_command(state: &Arc<Mutex<State>>, command: &str) {
+    // state could theoretically be used for all sorts of things
     // e.g. a /warp_all command, which would send a message to all clients
-    // or a command to get info about currently connected players
     match command {
         "/exit" => {
             println!("terminating server");
             process::exit(0);
         }
+        "/stats" => print_stats(state),
         "" => {}
         _ => println!("unrecognized command: {command}"),
     }
 }
+
+/// Prints the round trip time, loss, and packet counts of every connected player's state packets.
+fn print_stats(state: &Arc<Mutex<State>>) {
+    let link_stats = state.lock().unwrap().link_stats();
+    if link_stats.is_empty() {
+        println!("no players connected");
+        return;
+    }
+    for link in link_stats {
+        let rtt = match link.rtt {
+            Some(rtt) => format!("{rtt:.0} ms"),
+            None => "unknown".to_owned(),
+        };
+        let stats = link.stats;
+        println!(
+            "{:02x} ({}): round trip {rtt}, loss {:.1}% ({} of {} acked), received {} ({} reordered, {} duplicates)",
+            link.id,
+            link.name,
+            link.loss * 100.0,
+            stats.acked,
+            stats.sent,
+            stats.received,
+            stats.reordered,
+            stats.duplicates,
+        );
+    }
+}
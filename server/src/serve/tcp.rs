@@ -5,7 +5,7 @@ use crate::{
 use futures_util::{SinkExt, StreamExt};
 use std::sync::{Arc, Mutex};
 use tokio::{net::TcpStream, sync::mpsc::UnboundedReceiver};
-use tokio_tungstenite::WebSocketStream;
+use tokio_tungstenite::{WebSocketStream, tungstenite::Message};
 
 struct Connection {
     ws_stream: WebSocketStream<TcpStream>,
@@ -55,6 +55,9 @@ pub async fn handle_connection(state: Arc<Mutex<State>>, raw_stream: TcpStream)
                 if msg.is_close() {
                     break "received close message".to_owned();
                 }
+                if let Err(err) = handle_message(&connection, msg) {
+                    break err;
+                }
             }
         }
     };
@@ -71,10 +74,11 @@ async fn receive_connection(
     let info = receive_connect_message(&mut ws_stream)
         .await
         .map_err(|e| format!("failed to receive connect message: {e}"))?;
-    let (id, rx, players) = state.lock().unwrap().connect(info).ok_or("server full".to_owned())?;
+    let (id, rx, players, fec) =
+        state.lock().unwrap().connect(info).ok_or("server full".to_owned())?;
     let mut connection = Connection { ws_stream, id, rx, state };
 
-    let msg = ServerMessage::Connected { id, players };
+    let msg = ServerMessage::Connected { id, players, fec };
     let msg = serde_json::to_string(&msg).unwrap();
     connection
         .ws_stream
@@ -96,21 +100,43 @@ async fn receive_connect_message(
         if msg.is_close() {
             return Err("received close message".to_owned());
         }
-        if !msg.is_text() && !msg.is_binary() {
+        let Some(msg) = parse_message(&msg)? else {
             continue;
-        }
-
-        // Parse message
-        let msg = msg.to_text().map_err(|e| format!("failed to cast message to text: {e}"))?;
-        let msg = serde_json::from_str::<ClientMessage>(msg)
-            .map_err(|e| format!("failed to deserialize message: {e}"))?;
+        };
 
         return match msg {
             ClientMessage::Connect(info) => Ok(info),
+            _ => Err("expected connect message".to_owned()),
         };
     }
 }
 
+/// Handles a message from a player after they've connected.
+fn handle_message(connection: &Connection, msg: Message) -> Result<(), String> {
+    let Some(msg) = parse_message(&msg)? else {
+        return Ok(());
+    };
+    match msg {
+        ClientMessage::Connect(_) => Err("received connect message after connecting".to_owned()),
+        ClientMessage::RegisterZone { name } => {
+            connection.state.lock().unwrap().register_zone(connection.id, name);
+            Ok(())
+        }
+    }
+}
+
+/// Parses a client message, or returns None if it's a kind of WebSocket message that doesn't hold
+/// one, like a ping.
+fn parse_message(msg: &Message) -> Result<Option<ClientMessage>, String> {
+    if !msg.is_text() && !msg.is_binary() {
+        return Ok(None);
+    }
+    let msg = msg.to_text().map_err(|e| format!("failed to cast message to text: {e}"))?;
+    serde_json::from_str::<ClientMessage>(msg)
+        .map(Some)
+        .map_err(|e| format!("failed to deserialize message: {e}"))
+}
+
 async fn send_updates(
     ws_stream: &mut WebSocketStream<TcpStream>,
     buf: &mut Vec<ServerMessage>,
@@ -1,48 +1,131 @@
-use crate::state::{PlayerState, STATE_LEN, State};
+use crate::{
+    acks::{HEADER_LEN, Header},
+    bits::Writer,
+    codec, parity,
+    schema::STATE_LEN,
+    state::State,
+};
 use std::{
     net::SocketAddr,
     sync::{Arc, Mutex},
 };
 use tokio::net::UdpSocket;
 
-const MAX_STATES_PER_PACKET: usize = 21;
-const MAX_PACKET_LEN: usize = MAX_STATES_PER_PACKET * STATE_LEN;
-const _: () = assert!(MAX_PACKET_LEN <= 508);
-const _: () = assert!(MAX_PACKET_LEN + STATE_LEN > 508);
+// the first byte of every UDP packet says what the rest of it holds
+pub const PACKET_STATE: u8 = 0;
+pub const PACKET_TIME: u8 = 1;
+const PACKET_PARITY: u8 = 2;
+
+// state packets start with the kind, then an acks::Header, then states encoded with codec. ours put a
+// codec::Frame before their states
+pub const MIN_STATE_PACKET_LEN: usize = 1 + HEADER_LEN + codec::MIN_LEN;
+pub const MAX_STATE_PACKET_LEN: usize =
+    1 + HEADER_LEN + (codec::FULL_BITS * (1 + codec::MAX_REDUNDANT)).div_ceil(8);
+pub const PING_LEN: usize = 6;
+const PONG_LEN: usize = 9;
+pub const MAX_CLIENT_PACKET_LEN: usize = MAX_STATE_PACKET_LEN;
+const _: () = assert!(PING_LEN <= MAX_CLIENT_PACKET_LEN);
+
+// the largest UDP payload that's never fragmented
+const MAX_PACKET_LEN: usize = 508;
+// a parity packet is as long as the longest packet it covers plus its header, so state packets to
+// players who get parity are kept short enough for it to fit too
+const MAX_PROTECTED_PACKET_LEN: usize = MAX_PACKET_LEN - parity::HEADER_LEN;
 
 // TODO should send_to be put in a tokio::spawn()?
 pub async fn handle_packet(
     state: Arc<Mutex<State>>,
-    (id, millis, player_state): (u8, u32, PlayerState),
+    header: Header,
+    encoded: Vec<u8>,
     udp_socket: Arc<UdpSocket>,
     addr: SocketAddr,
 ) {
-    let Some(updates) = state.lock().unwrap().update(id, millis, player_state) else {
-        return;
+    let packets = {
+        let mut state = state.lock().unwrap();
+        let Some((id, updates)) = state.update(header, &encoded) else {
+            return;
+        };
+        pack(&mut state, id, updates)
     };
+    for packet in packets {
+        send_to(udp_socket.clone(), &packet, addr).await;
+    }
+}
 
-    let mut buf = [0u8; MAX_PACKET_LEN];
-    let mut states_in_buf = 0;
-    for bytes in updates {
-        // states_in_buf ranges from 0 to MAX_STATES_PER_PACKET - 1 here so copy target will always
-        // be within buf
-        let start = states_in_buf * STATE_LEN;
-        let end = start + STATE_LEN;
-        buf[start..end].copy_from_slice(&bytes[..]);
-        states_in_buf += 1;
-        if states_in_buf == MAX_STATES_PER_PACKET {
-            // because states_in_buf is MAX_STATES_PER_PACKET, we know buf is full
-            send_to(udp_socket.clone(), &buf[..], addr).await;
-            states_in_buf = 0;
+/// Encodes updates for `id` into as few state packets as they fit in, each followed by a parity
+/// packet if it completes a parity group.
+fn pack(state: &mut State, id: u8, updates: Vec<[u8; STATE_LEN]>) -> Vec<Vec<u8>> {
+    let max_len = if state.has_parity(id) { MAX_PROTECTED_PACKET_LEN } else { MAX_PACKET_LEN };
+    let mut packets = Vec::new();
+    let mut packet: Option<(u16, codec::Frame, Writer)> = None;
+    for (i, update) in updates.iter().enumerate() {
+        // start a new packet whenever the update might not fit in the current one, since how long
+        // it is depends on the packet's sequence number
+        if packet.as_ref().is_none_or(|(_, _, writer)| {
+            writer.bits_written() + codec::MAX_FRAMED_BITS > max_len * 8
+        }) {
+            let Some(header) = state.next_header(id) else {
+                break;
+            };
+            // picked from every update left, even though they might not all fit in this packet
+            let frame = state.frame(id, header.sequence, &updates[i..]);
+            let mut writer = Writer::with_capacity(max_len);
+            writer.write(PACKET_STATE as u32, 8);
+            writer.write_bytes(&header.to_bytes());
+            frame.write(&mut writer);
+            if let Some((sequence, _, full)) = packet.replace((header.sequence, frame, writer)) {
+                finish(state, id, (sequence, full), &mut packets);
+            }
         }
+        let (sequence, frame, writer) = packet.as_mut().unwrap();
+        state.encode_update(id, *sequence, *update, frame, writer);
+    }
+    if let Some((sequence, _, full)) = packet {
+        finish(state, id, (sequence, full), &mut packets);
     }
-    if states_in_buf != 0 {
-        // states_in_buf ranges from 1 to MAX_STATES_PER_PACKET - 1, so end is always within buf
-        let end = states_in_buf * STATE_LEN;
-        send_to(udp_socket, &buf[..end], addr).await;
+    packets
+}
+
+/// Pads the state packet with sequence to a whole byte and adds it to packets, along with the
+/// parity packet it completes, if any.
+fn finish(
+    state: &mut State,
+    id: u8,
+    (sequence, writer): (u16, Writer),
+    packets: &mut Vec<Vec<u8>>,
+) {
+    // states are packed back to back, and the last one is padded to a whole byte
+    let packet = writer.finish();
+    let parity = state.protect(id, sequence, &packet);
+    packets.push(packet);
+    if let Some(parity) = parity {
+        let mut parity_packet = Vec::with_capacity(1 + parity.len());
+        parity_packet.push(PACKET_PARITY);
+        parity_packet.extend(parity);
+        packets.push(parity_packet);
     }
 }
 
+/// Answers a ping with the client's millis echoed back and the server's millis from when the ping
+/// arrived, so the client can work out its round trip time and how far off its clock is.
+pub async fn handle_ping(
+    state: Arc<Mutex<State>>,
+    ping: [u8; PING_LEN],
+    millis: u32,
+    udp_socket: Arc<UdpSocket>,
+    addr: SocketAddr,
+) {
+    if !state.lock().unwrap().is_connected(ping[1]) {
+        return;
+    }
+
+    let mut buf = [0u8; PONG_LEN];
+    buf[0] = PACKET_TIME;
+    buf[1..5].copy_from_slice(&ping[2..6]);
+    buf[5..9].copy_from_slice(&millis.to_be_bytes());
+    send_to(udp_socket, &buf[..], addr).await;
+}
+
 async fn send_to(udp_socket: Arc<UdpSocket>, buf: &[u8], addr: SocketAddr) {
     if let Err(err) = udp_socket.send_to(buf, addr).await {
         println!("error sending UDP packet: {err}");
@@ -1,16 +1,31 @@
-use crate::message::{ConnectInfo, PlayerInfo, ServerMessage};
+use crate::{
+    acks::{Acks, Header, MAX_SENT, Stats},
+    bits::{Reader, Writer},
+    codec,
+    message::{ConnectInfo, PlayerInfo, ServerMessage},
+    parity::{self, Parity},
+    schema::{ID, MILLIS, STATE_LEN, ZONE},
+};
 use rand::{Rng, SeedableRng, rngs::SmallRng};
-use std::collections::{BTreeMap, HashMap, HashSet};
+use std::{
+    collections::{BTreeMap, HashMap, HashSet},
+    hash::Hash,
+    time::Instant,
+};
 use tokio::sync::mpsc::{self, UnboundedReceiver, UnboundedSender};
 
-// semi-arbitrary limit on number of connected players, but this guarantees that server updates fit
-// into a single packet
+// semi-arbitrary limit on number of connected players. updates to a client are split over as many
+// packets as they need, so this doesn't bound how many states fit in one
 const MAX_PLAYERS: usize = 22;
 
 // how many updates to keep for each player
 const MAX_UPDATES: usize = 20;
 
-pub const STATE_LEN: usize = 24;
+// states refer to zones by an 8-bit index into the zone table. indices are never reused, since
+// clients keep them for the whole connection, so once this many zones are registered, new ones are
+// rejected until the server restarts. the game has far fewer levels than this
+const MAX_ZONES: usize = 256;
+const MAX_ZONE_NAME_LEN: usize = 256;
 
 pub struct PlayerState {
     bytes: [u8; STATE_LEN],
@@ -21,8 +36,8 @@ impl PlayerState {
     /// Creates a new PlayerState from its byte representation. Also returns the parsed id and
     /// millis.
     pub fn from_bytes(bytes: [u8; STATE_LEN]) -> (u8, u32, Self) {
-        let id = bytes[0];
-        let millis = u32::from_be_bytes(bytes[1..5].try_into().unwrap());
+        let id = ID.read(&bytes, 0) as u8;
+        let millis = MILLIS.read(&bytes, 0);
         (id, millis, Self { bytes, sent_to: HashSet::new() })
     }
 }
@@ -32,11 +47,77 @@ struct Player {
     name: String,
     states: BTreeMap<u32, PlayerState>,
     tx: UnboundedSender<ServerMessage>,
+    acks: Acks,
+    // the states this player sent in each of their last MAX_SENT packets, by sequence number, so
+    // deltas from them can be decoded
+    received: [Option<(u16, [u8; STATE_LEN])>; MAX_SENT],
+    // the states of other players sent to this player in each of our last MAX_SENT packets to them,
+    // by sequence number
+    in_flight: [(u16, Vec<[u8; STATE_LEN]>); MAX_SENT],
+    // the newest state of each other player that this player has acked, and the sequence number of
+    // the packet it went out in, so their next states can be sent as deltas from it
+    baselines: HashMap<u8, (u16, [u8; STATE_LEN])>,
+    // the parity of our packets to this player, if they asked for it
+    parity: Option<Parity>,
+}
+
+/// A connected player's link statistics, for diagnostics.
+pub struct LinkStats {
+    pub id: u8,
+    pub name: String,
+    pub rtt: Option<f32>,
+    pub loss: f32,
+    pub stats: Stats,
 }
 
 impl Player {
-    fn new(color: [u8; 3], name: String, tx: UnboundedSender<ServerMessage>) -> Self {
-        Self { color, name, states: BTreeMap::new(), tx }
+    fn new(color: [u8; 3], name: String, tx: UnboundedSender<ServerMessage>, fec: u8) -> Self {
+        Self {
+            color,
+            name,
+            states: BTreeMap::new(),
+            tx,
+            acks: Acks::new(),
+            received: [None; MAX_SENT],
+            in_flight: std::array::from_fn(|_| (0, Vec::new())),
+            baselines: HashMap::new(),
+            parity: (fec != 0).then(|| Parity::new(fec)),
+        }
+    }
+
+    /// Returns the state this player sent in the packet with sequence, if it's remembered.
+    fn received_state(&self, sequence: u16) -> Option<[u8; STATE_LEN]> {
+        match self.received[sequence as usize % MAX_SENT] {
+            Some((received_sequence, bytes)) if received_sequence == sequence => Some(bytes),
+            _ => None,
+        }
+    }
+
+    /// Records the header of a packet from this player, along with the state it held, and moves
+    /// baselines up to the states in any of our packets it acks. Returns false if the packet is a
+    /// duplicate or too old, in which case it should be dropped.
+    fn receive(&mut self, header: Header, bytes: [u8; STATE_LEN]) -> bool {
+        let Self { acks, in_flight, baselines, .. } = self;
+        let received = acks.receive(header, Instant::now(), |sequence| {
+            let (sent_sequence, states) = &in_flight[sequence as usize % MAX_SENT];
+            if *sent_sequence != sequence {
+                return;
+            }
+            // a packet can hold several states of a player, oldest first, and like the player we
+            // take the last of them
+            for state in states {
+                let newer = baselines
+                    .get(&state[0])
+                    .is_none_or(|(baseline, _)| sequence.wrapping_sub(*baseline) as i16 >= 0);
+                if newer {
+                    baselines.insert(state[0], (sequence, *state));
+                }
+            }
+        });
+        if received {
+            self.received[header.sequence as usize % MAX_SENT] = Some((header.sequence, bytes));
+        }
+        received
     }
 
     fn update(&mut self, millis: u32, player_state: PlayerState) {
@@ -63,18 +144,27 @@ impl Player {
 /// sent to players.
 pub struct State {
     players: HashMap<u8, Player>,
+    // the names of the zones players have been in, by the index states refer to them with. zones are
+    // never removed, so an index means the same zone for as long as the server runs
+    zones: Vec<String>,
     rng: SmallRng,
 }
 
 impl State {
     pub fn new() -> Self {
-        Self { players: HashMap::new(), rng: SmallRng::from_rng(&mut rand::rng()) }
+        Self {
+            players: HashMap::new(),
+            zones: Vec::new(),
+            rng: SmallRng::from_rng(&mut rand::rng()),
+        }
     }
 
+    /// Adds a player, and returns their id, the receiver for messages to them, the other players,
+    /// and the parity group size they'll get. Returns None if the server is full.
     pub fn connect(
         &mut self,
         info: ConnectInfo,
-    ) -> Option<(u8, UnboundedReceiver<ServerMessage>, Vec<PlayerInfo>)> {
+    ) -> Option<(u8, UnboundedReceiver<ServerMessage>, Vec<PlayerInfo>, u8)> {
         if self.players.len() == MAX_PLAYERS {
             return None;
         }
@@ -105,9 +195,15 @@ impl State {
         }
 
         let (tx, rx) = mpsc::unbounded_channel();
-        self.players.insert(id, Player::new(info.color, info.name, tx));
+        // these go out right after the Connected message, so the player can read other players'
+        // states from the start
+        for (zone, name) in self.zones.iter().enumerate() {
+            let _ = tx.send(ServerMessage::ZoneRegistered { zone: zone as u8, name: name.clone() });
+        }
+        let fec = parity::group_len(info.fec);
+        self.players.insert(id, Player::new(info.color, info.name, tx, fec));
 
-        Some((id, rx, players))
+        Some((id, rx, players, fec))
     }
 
     /// Removes the player associated with id from state and informs other players that they
@@ -118,25 +214,182 @@ impl State {
             return;
         }
 
-        for player in self.players.values() {
+        for player in self.players.values_mut() {
             let _ = player.tx.send(ServerMessage::PlayerLeft { id });
+            // a new player could be given the same id, so nothing can be a delta from these
+            player.baselines.remove(&id);
+            for (_, states) in &mut player.in_flight {
+                states.retain(|state| state[0] != id);
+            }
+        }
+    }
+
+    pub fn is_connected(&self, id: u8) -> bool {
+        self.players.contains_key(&id)
+    }
+
+    /// Tells the player with `id` the index of the zone called name, giving it the next free index
+    /// and telling every other player about it too if it's new. If it can't be given one, only the
+    /// player is told, with the reason.
+    pub fn register_zone(&mut self, id: u8, name: String) {
+        if let Some(zone) = self.zones.iter().position(|zone| *zone == name) {
+            // everyone else was told when it was added or when they connected
+            if let Some(player) = self.players.get(&id) {
+                let _ = player.tx.send(ServerMessage::ZoneRegistered { zone: zone as u8, name });
+            }
+            return;
+        }
+        if name.len() > MAX_ZONE_NAME_LEN {
+            println!("{id:02x}: zone name is too long to register: {} bytes", name.len());
+            let reason = format!("the name is longer than {MAX_ZONE_NAME_LEN} bytes");
+            self.reject_zone(id, name, reason);
+            return;
+        }
+        if self.zones.len() == MAX_ZONES {
+            println!("{id:02x}: zone table is full, so \"{name}\" can't be registered");
+            self.reject_zone(id, name, format!("the server already has {MAX_ZONES} zones"));
+            return;
+        }
+
+        // clients still key their own per-zone settings by this hash, so those can't tell these apart
+        let hash = zone_hash(&name);
+        for other in self.zones.iter().filter(|other| zone_hash(other) == hash) {
+            println!("zones \"{name}\" and \"{other}\" have the same hash ({hash:08x})");
+        }
+
+        let zone = self.zones.len() as u8;
+        println!("{id:02x}: registered zone {zone}: \"{name}\"");
+        for player in self.players.values() {
+            let _ = player.tx.send(ServerMessage::ZoneRegistered { zone, name: name.clone() });
+        }
+        self.zones.push(name);
+    }
+
+    fn reject_zone(&self, id: u8, name: String, reason: String) {
+        if let Some(player) = self.players.get(&id) {
+            let _ = player.tx.send(ServerMessage::ZoneRejected { name, reason });
+        }
+    }
+
+    /// Updates player state from a state packet's header and encoded states, and returns the id of
+    /// the player it came from and the updates of other connected players to send them (see
+    /// filtered_state). Returns None if the states aren't from a connected player, can't be
+    /// decoded, or the packet was a duplicate.
+    pub fn update(&mut self, header: Header, encoded: &[u8]) -> Option<(u8, Vec<[u8; STATE_LEN]>)> {
+        let id = *encoded.first()?;
+        let player = self.players.get_mut(&id)?;
+        let mut reader = Reader::new(encoded);
+        let newest = codec::decode(&mut reader, None, |age| {
+            player.received_state(header.sequence.wrapping_sub(age))
+        })?;
+        // then any earlier states the client repeated, as deltas from the newest one, until only
+        // padding up to the end of the last byte is left
+        let mut redundant = [[0u8; STATE_LEN]; codec::MAX_REDUNDANT];
+        let mut count = 0;
+        while encoded.len() * 8 - reader.bits_read() >= 8 {
+            if count == codec::MAX_REDUNDANT {
+                return None;
+            }
+            redundant[count] = codec::decode(&mut reader, None, |_| Some(newest))?;
+            if redundant[count][0] != id {
+                return None;
+            }
+            count += 1;
+        }
+        if !player.receive(header, newest) {
+            return None;
         }
+        // copies of states that already arrived have the same millis, so these drop them
+        for bytes in redundant[..count].iter().rev().chain([&newest]) {
+            let (_, millis, player_state) = PlayerState::from_bytes(*bytes);
+            player.update(millis, player_state);
+        }
+
+        Some((id, self.filtered_state(id)))
+    }
+
+    /// Returns the header for the next state packet sent to `id`. Returns None if `id` isn't a
+    /// connected player.
+    pub fn next_header(&mut self, id: u8) -> Option<Header> {
+        let player = self.players.get_mut(&id)?;
+        let header = player.acks.send(Instant::now());
+        let (sequence, states) = &mut player.in_flight[header.sequence as usize % MAX_SENT];
+        *sequence = header.sequence;
+        states.clear();
+        Some(header)
     }
 
-    /// Updates player state and returns up to one update for each other connected player. Returns
-    /// None if `id` isn't a connected player.
-    pub fn update(
+    /// Returns the frame for the state packet to `id` with sequence that updates will go in: the
+    /// baseline age and zone most of them have, and the first one's millis.
+    pub fn frame(&self, id: u8, sequence: u16, updates: &[[u8; STATE_LEN]]) -> codec::Frame {
+        let baselines = self.players.get(&id).map(|player| &player.baselines);
+        let ages = updates.iter().map(|update| {
+            baselines
+                .and_then(|baselines| baselines.get(&update[0]))
+                .map(|(baseline, _)| sequence.wrapping_sub(*baseline))
+                .filter(|age| *age <= codec::MAX_AGE)
+                .unwrap_or(0)
+        });
+        codec::Frame {
+            age: most_common(ages),
+            millis: updates.first().map_or(0, |update| MILLIS.read(update, 0)),
+            zone: most_common(updates.iter().map(|update| ZONE.read(update, 0))),
+        }
+    }
+
+    /// Encodes an update in frame onto the end of out, which is the state packet to `id` with
+    /// sequence, as a delta from the newest state of the same player that `id` has acked.
+    pub fn encode_update(
         &mut self,
         id: u8,
-        millis: u32,
-        player_state: PlayerState,
-    ) -> Option<Vec<[u8; STATE_LEN]>> {
-        let player = self.players.get_mut(&id)?;
-        player.update(millis, player_state);
+        sequence: u16,
+        update: [u8; STATE_LEN],
+        frame: &codec::Frame,
+        out: &mut Writer,
+    ) {
+        let Some(player) = self.players.get_mut(&id) else {
+            return;
+        };
+        let baseline = player
+            .baselines
+            .get(&update[0])
+            .map(|(baseline, bytes)| (sequence.wrapping_sub(*baseline), bytes));
+        codec::encode(&update, baseline, Some(frame), out);
+        player.in_flight[sequence as usize % MAX_SENT].1.push(update);
+    }
+
+    /// Returns whether state packets to `id` are followed by parity packets.
+    pub fn has_parity(&self, id: u8) -> bool {
+        self.players.get(&id).is_some_and(|player| player.parity.is_some())
+    }
 
-        Some(self.filtered_state(id))
+    /// Adds the state packet to `id` with sequence to their parity group, and returns the parity
+    /// packet after the kind if that completes the group.
+    pub fn protect(&mut self, id: u8, sequence: u16, packet: &[u8]) -> Option<Vec<u8>> {
+        self.players.get_mut(&id)?.parity.as_mut()?.add(sequence, packet)
+    }
+
+    /// Returns the link statistics of every connected player, sorted by id.
+    pub fn link_stats(&self) -> Vec<LinkStats> {
+        let mut link_stats: Vec<_> = self
+            .players
+            .iter()
+            .map(|(id, player)| LinkStats {
+                id: *id,
+                name: player.name.clone(),
+                rtt: player.acks.rtt(),
+                loss: player.acks.loss(),
+                stats: player.acks.stats(),
+            })
+            .collect();
+        link_stats.sort_by_key(|link_stats| link_stats.id);
+        link_stats
     }
 
+    /// Returns the updates of every other player that haven't been sent to `id` yet, oldest first
+    /// for each player. Only each player's newest 1 + MAX_REDUNDANT updates are looked at: that's
+    /// as far back as a state recovered from a repeat in a later upload can be, and anything older
+    /// is too stale to be worth sending.
     fn filtered_state(&mut self, id: u8) -> Vec<[u8; STATE_LEN]> {
         let mut filtered_state = Vec::with_capacity(self.players.len());
         for (player_id, player) in &mut self.players {
@@ -144,15 +397,102 @@ impl State {
                 continue;
             }
 
-            // get the most recent update that hasn't been sent to the player
-            for state in player.states.values_mut().rev() {
-                if !state.sent_to.contains(&id) {
-                    state.sent_to.insert(id);
+            let recent = player.states.len().saturating_sub(1 + codec::MAX_REDUNDANT);
+            for state in player.states.values_mut().skip(recent) {
+                if state.sent_to.insert(id) {
                     filtered_state.push(state.bytes);
-                    break;
                 }
             }
         }
         filtered_state
     }
 }
+
+/// The hash clients used to send in place of a zone's name, and still key their zone settings by:
+/// 32-bit FNV-1a (with their offset basis) over the name's UTF-16 code units, high byte first.
+fn zone_hash(name: &str) -> u32 {
+    let mut hash: u32 = 0x911c9dc5;
+    for unit in name.encode_utf16() {
+        for byte in unit.to_be_bytes() {
+            hash ^= byte as u32;
+            hash = hash.wrapping_mul(0x01000193);
+        }
+    }
+    hash
+}
+
+/// Returns the value that comes up most often, or the default if there are none.
+fn most_common<T: Copy + Default + Eq + Hash>(values: impl Iterator<Item = T>) -> T {
+    let mut counts = HashMap::new();
+    for value in values {
+        *counts.entry(value).or_insert(0) += 1;
+    }
+    counts.into_iter().max_by_key(|(_, count)| *count).map_or(T::default(), |(value, _)| value)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn player() -> Player {
+        Player::new([0; 3], String::new(), mpsc::unbounded_channel().0, 0)
+    }
+
+    fn state(id: u8, millis: u32) -> [u8; STATE_LEN] {
+        let mut state = [0; STATE_LEN];
+        ID.write(&mut state, 0, id as u32);
+        MILLIS.write(&mut state, 0, millis);
+        state
+    }
+
+    /// Records a packet of ours holding states as sent, returning its sequence number.
+    fn send(player: &mut Player, states: Vec<[u8; STATE_LEN]>) -> u16 {
+        let sequence = player.acks.send(Instant::now()).sequence;
+        player.in_flight[sequence as usize % MAX_SENT] = (sequence, states);
+        sequence
+    }
+
+    fn ack(sequence: u16, ack: u16, ack_bits: u16) -> Header {
+        Header { sequence, has_ack: true, ack, ack_bits }
+    }
+
+    #[test]
+    fn zones_that_cant_be_registered_are_rejected() {
+        let mut state = State::new();
+        let (tx, mut rx) = mpsc::unbounded_channel();
+        state.players.insert(1, Player::new([0; 3], String::new(), tx, 0));
+
+        state.register_zone(1, "a".repeat(MAX_ZONE_NAME_LEN + 1));
+        assert!(matches!(rx.try_recv(), Ok(ServerMessage::ZoneRejected { .. })));
+
+        for zone in 0..MAX_ZONES {
+            state.register_zone(1, zone.to_string());
+            assert!(matches!(rx.try_recv(), Ok(ServerMessage::ZoneRegistered { .. })));
+        }
+        state.register_zone(1, "full".to_owned());
+        assert!(
+            matches!(rx.try_recv(), Ok(ServerMessage::ZoneRejected { name, .. }) if name == "full")
+        );
+        assert_eq!(state.zones.len(), MAX_ZONES);
+    }
+
+    #[test]
+    fn baseline_is_last_state_of_a_player_in_an_acked_packet() {
+        let mut player = player();
+        let sequence = send(&mut player, vec![state(3, 100), state(5, 100), state(3, 200)]);
+        assert!(player.receive(ack(0, sequence, 0), state(1, 0)));
+        assert_eq!(player.baselines[&3], (sequence, state(3, 200)));
+        assert_eq!(player.baselines[&5], (sequence, state(5, 100)));
+    }
+
+    #[test]
+    fn acking_an_older_packet_keeps_the_newer_baseline() {
+        let mut player = player();
+        let older = send(&mut player, vec![state(3, 100)]);
+        let newer = send(&mut player, vec![state(3, 200)]);
+        assert!(player.receive(ack(0, newer, 0), state(1, 0)));
+        assert!(player.receive(ack(1, newer, 1), state(1, 0)));
+        assert_eq!(older, newer.wrapping_sub(1));
+        assert_eq!(player.baselines[&3], (newer, state(3, 200)));
+    }
+}